@@ -0,0 +1,120 @@
+// Copyright 2019 Jason Kim. All rights reserved.
+/*
+benchmark_util.h
+
+Synthetic images shared by the benchmarks.
+*/
+
+#ifndef BENCHMARKS_BENCHMARK_UTIL_H_
+#define BENCHMARKS_BENCHMARK_UTIL_H_
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bitmapparser.h"
+
+namespace bench {
+
+/*
+Writes a 24-bit bitmap of the given size filled with pseudo random
+pixels, so every benchmark sees the same data. The headers are
+written by hand, so the file does not depend on the code under test.
+*/
+inline void write_synthetic(const std::string& filename,
+    size_t width, size_t height) {
+    const size_t padding = BitmapParser::row_padding(width);
+    const size_t stride = width * 3 + padding;
+    const size_t data_size = stride * height;
+    std::vector<uint8_t> file(54 + data_size, 0);
+    uint8_t* bytes = file.data();
+    auto put16 = [](uint8_t* dst, uint32_t value) {
+        dst[0] = static_cast<uint8_t>(value);
+        dst[1] = static_cast<uint8_t>(value >> 8);
+    };
+    auto put32 = [](uint8_t* dst, uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            dst[i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    };
+    bytes[0] = 'B';
+    bytes[1] = 'M';
+    put32(bytes + 2, static_cast<uint32_t>(file.size()));
+    put32(bytes + 10, 54);
+    put32(bytes + 14, 40);
+    put32(bytes + 18, static_cast<uint32_t>(width));
+    put32(bytes + 22, static_cast<uint32_t>(height));
+    put16(bytes + 26, 1);
+    put16(bytes + 28, 24);
+    put32(bytes + 34, static_cast<uint32_t>(data_size));
+    put32(bytes + 38, 2835);
+    put32(bytes + 42, 2835);
+    // A small LCG is enough to defeat any shortcut on flat colors.
+    uint32_t state = 12345;
+    for (size_t row = 0; row < height; ++row) {
+        uint8_t* dst = bytes + 54 + row * stride;
+        for (size_t i = 0; i < width * 3; ++i) {
+            state = state * 1103515245u + 12345u;
+            dst[i] = static_cast<uint8_t>(state >> 16);
+        }
+    }
+    FILE* fileptr = fopen(filename.c_str(), "wb");
+    if (fileptr == nullptr) throw FileOpenException();
+    const size_t written = fwrite(bytes, 1, file.size(), fileptr);
+    fclose(fileptr);
+    if (written != file.size()) throw IOException();
+}
+
+// Removes the generated files when the benchmarks exit.
+class SyntheticFiles {
+ public:
+    ~SyntheticFiles() {
+        for (auto& entry : _files) remove(entry.second.c_str());
+    }
+    // Path of a synthetic image of the given size, made on first use.
+    const std::string& get(size_t width, size_t height) {
+        const std::pair<size_t, size_t> key(width, height);
+        auto found = _files.find(key);
+        if (found != _files.end()) return found->second;
+        const std::string filename = "bitmapparser_bench_" +
+            std::to_string(width) + "x" + std::to_string(height) + ".bmp";
+        write_synthetic(filename, width, height);
+        return _files.emplace(key, filename).first->second;
+    }
+
+ private:
+    std::map<std::pair<size_t, size_t>, std::string> _files;
+};
+
+inline const std::string& synthetic(size_t width, size_t height) {
+    static SyntheticFiles files;
+    return files.get(width, height);
+}
+
+/*
+Reports throughput in bytes of 24-bit pixel data and in pixels,
+for the given number of pixels handled per iteration.
+*/
+inline void set_throughput(benchmark::State& state, size_t pixels) {
+    const int64_t total = static_cast<int64_t>(pixels) *
+        static_cast<int64_t>(state.iterations());
+    state.SetBytesProcessed(total * 3);
+    state.counters["pixels/s"] = benchmark::Counter(
+        static_cast<double>(total), benchmark::Counter::kIsRate);
+}
+
+// Image sizes the benchmarks run over, from thumbnails to large scans.
+inline void image_sizes(benchmark::internal::Benchmark* bench) {
+    bench->Args({256, 256})
+        ->Args({1021, 767})
+        ->Args({1920, 1080})
+        ->Args({4096, 4096});
+}
+
+}  // namespace bench
+
+#endif  // BENCHMARKS_BENCHMARK_UTIL_H_
@@ -0,0 +1,122 @@
+// Copyright 2019 Jason Kim. All rights reserved.
+/*
+bitmapparser_benchmark.cpp
+
+Throughput of reading, writing and editing synthetic 24-bit images.
+Every benchmark takes the width and height of the image as arguments,
+and reports MB/s of pixel data and pixels/s.
+*/
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <string>
+
+#include "benchmarks/benchmark_util.h"
+#include "bitmapparser.h"
+
+namespace {
+
+size_t arg_width(const benchmark::State& state) {
+    return static_cast<size_t>(state.range(0));
+}
+
+size_t arg_height(const benchmark::State& state) {
+    return static_cast<size_t>(state.range(1));
+}
+
+void BM_Import(benchmark::State& state) {
+    const std::string& input =
+        bench::synthetic(arg_width(state), arg_height(state));
+    BitmapParser image;
+    for (auto _ : state) {
+        image.import(input.c_str());
+        benchmark::DoNotOptimize(image.read_pixels().data());
+    }
+    bench::set_throughput(state, arg_width(state) * arg_height(state));
+}
+BENCHMARK(BM_Import)->Apply(bench::image_sizes);
+
+void BM_Save(benchmark::State& state) {
+    BitmapParser image(bench::synthetic(arg_width(state), arg_height(state)));
+    const std::string output = "bitmapparser_bench_save.bmp";
+    for (auto _ : state) {
+        image.save(output.c_str());
+    }
+    remove(output.c_str());
+    bench::set_throughput(state, arg_width(state) * arg_height(state));
+}
+BENCHMARK(BM_Save)->Apply(bench::image_sizes);
+
+// Runs an in-place operation on the same image over and over.
+template <void (BitmapParser::*Operation)()>
+void BM_InPlace(benchmark::State& state) {
+    BitmapParser image(bench::synthetic(arg_width(state), arg_height(state)));
+    for (auto _ : state) {
+        (image.*Operation)();
+        benchmark::DoNotOptimize(image.read_pixels().data());
+        benchmark::ClobberMemory();
+    }
+    bench::set_throughput(state, arg_width(state) * arg_height(state));
+}
+BENCHMARK_TEMPLATE(BM_InPlace, &BitmapParser::transpose)
+    ->Name("BM_Transpose")->Apply(bench::image_sizes);
+BENCHMARK_TEMPLATE(BM_InPlace, &BitmapParser::rotate90_left)
+    ->Name("BM_Rotate90Left")->Apply(bench::image_sizes);
+BENCHMARK_TEMPLATE(BM_InPlace, &BitmapParser::rotate90_right)
+    ->Name("BM_Rotate90Right")->Apply(bench::image_sizes);
+BENCHMARK_TEMPLATE(BM_InPlace, &BitmapParser::flip_horizontal)
+    ->Name("BM_FlipHorizontal")->Apply(bench::image_sizes);
+BENCHMARK_TEMPLATE(BM_InPlace, &BitmapParser::flip_vertical)
+    ->Name("BM_FlipVertical")->Apply(bench::image_sizes);
+BENCHMARK_TEMPLATE(BM_InPlace, &BitmapParser::invert_colors)
+    ->Name("BM_InvertColors")->Apply(bench::image_sizes);
+BENCHMARK_TEMPLATE(BM_InPlace, &BitmapParser::grayscale)
+    ->Name("BM_Grayscale")->Apply(bench::image_sizes);
+BENCHMARK_TEMPLATE(BM_InPlace, &BitmapParser::sepia)
+    ->Name("BM_Sepia")->Apply(bench::image_sizes);
+BENCHMARK_TEMPLATE(BM_InPlace, &BitmapParser::isolate_red)
+    ->Name("BM_IsolateRed")->Apply(bench::image_sizes);
+BENCHMARK_TEMPLATE(BM_InPlace, &BitmapParser::isolate_green)
+    ->Name("BM_IsolateGreen")->Apply(bench::image_sizes);
+BENCHMARK_TEMPLATE(BM_InPlace, &BitmapParser::isolate_blue)
+    ->Name("BM_IsolateBlue")->Apply(bench::image_sizes);
+
+/*
+Crops the middle quarter of the image. Crop shrinks the image,
+so a fresh copy is made outside the timed region every iteration.
+Throughput counts the pixels that are kept.
+*/
+void BM_Crop(benchmark::State& state) {
+    const size_t width = arg_width(state);
+    const size_t height = arg_height(state);
+    const BitmapParser source(bench::synthetic(width, height));
+    BitmapParser image;
+    for (auto _ : state) {
+        state.PauseTiming();
+        image = source;
+        state.ResumeTiming();
+        image.crop(width / 4, height / 4,
+            width / 4 + width / 2 - 1, height / 4 + height / 2 - 1);
+        benchmark::DoNotOptimize(image.read_pixels().data());
+    }
+    bench::set_throughput(state, (width / 2) * (height / 2));
+}
+BENCHMARK(BM_Crop)->Apply(bench::image_sizes);
+
+// Superimposes an image half as wide and tall onto the middle.
+void BM_Superimpose(benchmark::State& state) {
+    const size_t width = arg_width(state);
+    const size_t height = arg_height(state);
+    BitmapParser image(bench::synthetic(width, height));
+    BitmapParser overlay(bench::synthetic(width / 2, height / 2));
+    for (auto _ : state) {
+        image.superimpose(overlay, width / 4, height / 4);
+        benchmark::DoNotOptimize(image.read_pixels().data());
+        benchmark::ClobberMemory();
+    }
+    bench::set_throughput(state, (width / 2) * (height / 2));
+}
+BENCHMARK(BM_Superimpose)->Apply(bench::image_sizes);
+
+}  // namespace
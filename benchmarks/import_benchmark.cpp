@@ -0,0 +1,109 @@
+// Copyright 2019 Jason Kim. All rights reserved.
+/*
+import_benchmark.cpp
+
+Compares import, which reads whole padded rows, with the original
+decoder, which read every channel with its own one-byte fread and
+seeked past the padding of every row.
+*/
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "benchmarks/benchmark_util.h"
+#include "bitmapparser.h"
+
+namespace {
+
+// Wrapper for fread with error handling, as the original decoder had.
+void check_read(void* buffer, size_t size, size_t count, FILE* stream) {
+    fread(buffer, size, count, stream);
+    if (feof(stream)) throw EOFException();
+    else if (ferror(stream)) throw IOException();
+}
+
+// Reads a little endian dword from the headers.
+uint32_t dword_at(const uint8_t* bytes) {
+    return static_cast<uint32_t>(bytes[0]) |
+        (static_cast<uint32_t>(bytes[1]) << 8) |
+        (static_cast<uint32_t>(bytes[2]) << 16) |
+        (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+/*
+The original import: pixels go into a vector per row, and are read
+three one-byte freads at a time, bottom-up.
+*/
+void import_per_pixel(const char* filename,
+    std::vector<std::vector<Pixel> >* pixels) {
+    FILE* fileptr = fopen(filename, "rb");
+    if (fileptr == nullptr) throw FileOpenException();
+    // The header and a 40-byte info header.
+    uint8_t headers[54];
+    check_read(headers, sizeof(char), sizeof(headers), fileptr);
+    const uint32_t width = dword_at(headers + 18);
+    const uint32_t height = dword_at(headers + 22);
+    const size_t padding = BitmapParser::row_padding(width);
+    pixels->clear();
+    pixels->resize(height);
+    for (std::vector<Pixel>& row : *pixels) {
+        row.reserve(width);
+    }
+    for (int row = static_cast<int>(height) - 1; row >= 0; --row) {
+        for (size_t col = 0; col < width; ++col) {
+            Pixel pix = {};
+            check_read(&(pix.blue), sizeof(char), 1, fileptr);
+            check_read(&(pix.green), sizeof(char), 1, fileptr);
+            check_read(&(pix.red), sizeof(char), 1, fileptr);
+            (*pixels)[row].push_back(pix);
+        }
+        fseek(fileptr, padding, SEEK_CUR);
+    }
+    fclose(fileptr);
+}
+
+void BM_ImportPerPixel(benchmark::State& state) {
+    const size_t width = static_cast<size_t>(state.range(0));
+    const size_t height = static_cast<size_t>(state.range(1));
+    const std::string& input = bench::synthetic(width, height);
+    std::vector<std::vector<Pixel> > pixels;
+    for (auto _ : state) {
+        import_per_pixel(input.c_str(), &pixels);
+        benchmark::DoNotOptimize(pixels.data());
+    }
+    bench::set_throughput(state, width * height);
+}
+BENCHMARK(BM_ImportPerPixel)->Apply(bench::image_sizes);
+
+// The row-at-a-time import through stdio that replaced it.
+void BM_ImportRows(benchmark::State& state) {
+    const size_t width = static_cast<size_t>(state.range(0));
+    const size_t height = static_cast<size_t>(state.range(1));
+    const std::string& input = bench::synthetic(width, height);
+    BitmapParser image;
+    for (auto _ : state) {
+        image.import(input.c_str());
+        benchmark::DoNotOptimize(image.read_pixels().data());
+    }
+    bench::set_throughput(state, width * height);
+}
+BENCHMARK(BM_ImportRows)->Apply(bench::image_sizes);
+
+// The pread import, on a single thread to compare with the others.
+void BM_ImportPread(benchmark::State& state) {
+    const size_t width = static_cast<size_t>(state.range(0));
+    const size_t height = static_cast<size_t>(state.range(1));
+    const std::string& input = bench::synthetic(width, height);
+    BitmapParser image;
+    for (auto _ : state) {
+        image.import(input.c_str(), 1);
+        benchmark::DoNotOptimize(image.read_pixels().data());
+    }
+    bench::set_throughput(state, width * height);
+}
+BENCHMARK(BM_ImportPread)->Apply(bench::image_sizes);
+
+}  // namespace
@@ -0,0 +1,105 @@
+// Copyright 2019 Jason Kim. All rights reserved.
+/*
+transpose_benchmark.cpp
+
+Compares the tiled transpose and one-pass rotations with the original
+methods: a transpose that copies pixel by pixel down the columns of
+the new image, and rotations that transpose and then flip. Both sides
+use the same contiguous pixel buffer, so only the access pattern and
+the number of passes differ.
+*/
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <string>
+
+#include "benchmarks/benchmark_util.h"
+#include "bitmapparser.h"
+
+namespace {
+
+// The original transpose, into a freshly allocated buffer.
+void transpose_naive(PixelBuffer* pixels) {
+    const size_t width = pixels->width();
+    const size_t height = pixels->height();
+    PixelBuffer new_pixels(height, width);
+    for (size_t row = 0; row < height; ++row) {
+        for (size_t col = 0; col < width; ++col) {
+            new_pixels[col][row] = (*pixels)[row][col];
+        }
+    }
+    pixels->swap(new_pixels);
+}
+
+// The original rotate90_left: transpose, then reverse the rows.
+void rotate90_left_two_pass(PixelBuffer* pixels) {
+    transpose_naive(pixels);
+    for (size_t top = 0, bottom = pixels->height();
+        top + 1 < bottom; ++top, --bottom) {
+        std::swap_ranges((*pixels)[top].begin(), (*pixels)[top].end(),
+            (*pixels)[bottom - 1].begin());
+    }
+}
+
+// The original rotate90_right: transpose, then reverse each row.
+void rotate90_right_two_pass(PixelBuffer* pixels) {
+    transpose_naive(pixels);
+    for (size_t row = 0; row < pixels->height(); ++row) {
+        std::reverse((*pixels)[row].begin(), (*pixels)[row].end());
+    }
+}
+
+template <void (*Operation)(PixelBuffer*)>
+void BM_Original(benchmark::State& state) {
+    const size_t width = static_cast<size_t>(state.range(0));
+    const size_t height = static_cast<size_t>(state.range(1));
+    BitmapParser image(bench::synthetic(width, height));
+    PixelBuffer pixels = image.take_pixels();
+    for (auto _ : state) {
+        Operation(&pixels);
+        benchmark::DoNotOptimize(pixels.data());
+        benchmark::ClobberMemory();
+    }
+    bench::set_throughput(state, width * height);
+}
+
+template <void (BitmapParser::*Operation)()>
+void BM_Current(benchmark::State& state) {
+    const size_t width = static_cast<size_t>(state.range(0));
+    const size_t height = static_cast<size_t>(state.range(1));
+    BitmapParser image(bench::synthetic(width, height));
+    for (auto _ : state) {
+        (image.*Operation)();
+        benchmark::DoNotOptimize(image.read_pixels().data());
+        benchmark::ClobberMemory();
+    }
+    bench::set_throughput(state, width * height);
+}
+
+/*
+Powers of two are the worst case for column walks, since every row
+maps to the same cache sets.
+*/
+void transpose_sizes(benchmark::internal::Benchmark* bench) {
+    bench->Args({256, 256})
+        ->Args({1024, 1024})
+        ->Args({1920, 1080})
+        ->Args({2048, 2048})
+        ->Args({4096, 4096});
+}
+
+BENCHMARK_TEMPLATE(BM_Original, transpose_naive)
+    ->Name("BM_TransposeNaive")->Apply(transpose_sizes);
+BENCHMARK_TEMPLATE(BM_Current, &BitmapParser::transpose)
+    ->Name("BM_TransposeTiled")->Apply(transpose_sizes);
+BENCHMARK_TEMPLATE(BM_Original, rotate90_left_two_pass)
+    ->Name("BM_Rotate90LeftTwoPass")->Apply(transpose_sizes);
+BENCHMARK_TEMPLATE(BM_Current, &BitmapParser::rotate90_left)
+    ->Name("BM_Rotate90LeftFused")->Apply(transpose_sizes);
+BENCHMARK_TEMPLATE(BM_Original, rotate90_right_two_pass)
+    ->Name("BM_Rotate90RightTwoPass")->Apply(transpose_sizes);
+BENCHMARK_TEMPLATE(BM_Current, &BitmapParser::rotate90_right)
+    ->Name("BM_Rotate90RightFused")->Apply(transpose_sizes);
+
+}  // namespace
@@ -5,7 +5,9 @@ bitmapparser.h
 A simple library to read, write, and edit bitmap images. 
 Written as a side project to study file processing, and for fun.
 
-Only 24-bit color (RGB, 0-255) without compression is supported.
+Only 8-bit images with a palette, 24-bit color (RGB, 0-255) without
+compression, and 32-bit color with an alpha or unused byte, uncompressed
+or with bitfield masks that cover whole bytes, are supported.
 
 The style confroms to Google's coding style guide for C++,
 and has been checked with cpplint.
@@ -21,6 +23,9 @@ June 27, 2019
 #include <iostream>
 // For storing bitmap information.
 #include <vector>
+#include <map>
+#include <memory>
+#include <type_traits>
 // Explicit include for compatibility.
 #include <string>
 // For exceptions and error handling.
@@ -28,6 +33,60 @@ June 27, 2019
 // For STL algorithms.
 #include <algorithm>
 #include <utility>
+// For copying rows of pixels.
+#include <cstring>
+// For running filters on several threads.
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+For SIMD color filters on x86, picked at runtime by CPU support.
+Define BITMAPPARSER_NO_SIMD to use the portable kernels only.
+*/
+#if !defined(BITMAPPARSER_NO_SIMD) && \
+    (defined(__x86_64__) || defined(__i386__) || \
+    defined(_M_X64) || defined(_M_IX86)) && \
+    (defined(__GNUC__) || defined(_MSC_VER))
+#define BITMAPPARSER_HAS_X86_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC allows intrinsics in any function.
+#define BITMAPPARSER_TARGET(isa)
+#else
+#define BITMAPPARSER_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+// For memory-mapped reading and positioned I/O, where supported.
+#if defined(__unix__) || defined(__APPLE__)
+#define BITMAPPARSER_HAS_MMAP 1
+#define BITMAPPARSER_HAS_PREAD 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// For memory resources as pixel allocators, from C++17 on.
+#if __cplusplus >= 201703L || \
+    (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#if defined(__has_include)
+#if __has_include(<memory_resource>)
+#define BITMAPPARSER_HAS_PMR 1
+#include <memory_resource>
+#endif
+#endif
+#endif
+
+// For timing operations, if instrumentation is compiled in.
+#ifdef BITMAPPARSER_INSTRUMENTATION
+#include <chrono>
+#endif
 
 // For organizing the 14-byte header.
 struct Header {
@@ -37,7 +96,11 @@ struct Header {
     uint32_t data_offset;
 };
 
-// For organizing the 40-byte info header.
+/*
+For organizing the 40-byte info header. The channel masks come after
+it in files with bitfield compression, and are part of the larger
+V4 (108-byte) and V5 (124-byte) info headers.
+*/
 struct InfoHeader {
     uint32_t size;
     uint32_t width;
@@ -50,6 +113,24 @@ struct InfoHeader {
     uint32_t y_pixels_per_meter;
     uint32_t colors_used;
     uint32_t important_colors;
+    uint32_t red_mask;
+    uint32_t green_mask;
+    uint32_t blue_mask;
+    uint32_t alpha_mask;
+};
+
+/*
+What the headers of a bitmap file say about it, without its pixels.
+valid is whether import would accept the headers, and expected_size
+is the size of the file the image would be saved as. Everything is
+zero for files that are not bitmaps at all.
+*/
+struct BitmapInfo {
+    bool valid;
+    uint32_t width;
+    uint32_t height;
+    uint16_t bits_per_pixel;
+    size_t expected_size;
 };
 
 // For representing standard RGB pixels (0-255).
@@ -59,13 +140,98 @@ struct Pixel {
     uint8_t blue;
 };
 
+// For representing pixels in the order they are stored in bitmap files.
+struct BgrPixel {
+    uint8_t blue;
+    uint8_t green;
+    uint8_t red;
+};
+
+// For representing pixels with an alpha channel, in file order.
+struct BgraPixel {
+    uint8_t blue;
+    uint8_t green;
+    uint8_t red;
+    uint8_t alpha;
+};
+
+// For representing grayscale pixels (0-255).
+struct GrayPixel {
+    uint8_t value;
+};
+
+/*
+PIXEL FORMATS
+Traits describing how BasicBitmapParser holds pixels in memory.
+PixelType is the pixel struct, which is bytes_per_pixel bytes wide,
+and red, green and blue are the byte offsets of its channels.
+Grayscale pixels have a single channel that stands for all three.
+Images are saved with file_bits_per_pixel bits per pixel and an
+info header of file_infoheader_size bytes.
+*/
+struct Rgb24Format {
+    typedef Pixel PixelType;
+    static constexpr size_t bytes_per_pixel = 3;
+    static constexpr size_t red = 0;
+    static constexpr size_t green = 1;
+    static constexpr size_t blue = 2;
+    static constexpr bool has_color = true;
+    static constexpr bool has_alpha = false;
+    static constexpr size_t file_bits_per_pixel = 24;
+    static constexpr size_t file_infoheader_size = 40;
+};
+
+struct Bgr24Format {
+    typedef BgrPixel PixelType;
+    static constexpr size_t bytes_per_pixel = 3;
+    static constexpr size_t red = 2;
+    static constexpr size_t green = 1;
+    static constexpr size_t blue = 0;
+    static constexpr bool has_color = true;
+    static constexpr bool has_alpha = false;
+    static constexpr size_t file_bits_per_pixel = 24;
+    static constexpr size_t file_infoheader_size = 40;
+};
+
+/*
+The alpha channel, at offset 3, is left alone by the color filters.
+Saved as 32-bit files with a V4 info header that holds the masks.
+*/
+struct Bgra32Format {
+    typedef BgraPixel PixelType;
+    static constexpr size_t bytes_per_pixel = 4;
+    static constexpr size_t red = 2;
+    static constexpr size_t green = 1;
+    static constexpr size_t blue = 0;
+    static constexpr bool has_color = true;
+    static constexpr bool has_alpha = true;
+    static constexpr size_t file_bits_per_pixel = 32;
+    static constexpr size_t file_infoheader_size = 108;
+};
+
+/*
+Saved as 8-bit files with a palette of 256 grays, so each pixel is
+its own index into the palette.
+*/
+struct Gray8Format {
+    typedef GrayPixel PixelType;
+    static constexpr size_t bytes_per_pixel = 1;
+    static constexpr size_t red = 0;
+    static constexpr size_t green = 0;
+    static constexpr size_t blue = 0;
+    static constexpr bool has_color = false;
+    static constexpr bool has_alpha = false;
+    static constexpr size_t file_bits_per_pixel = 8;
+    static constexpr size_t file_infoheader_size = 40;
+};
+
 // Custom exception for when the bitmap signature is wrong.
 class InvalidFormatException : public std::exception {
     const char* what() const throw() override {
         // Workaround for 80 char column limit.
-        std::string msg = "Invalid or incompatible file.\n";
-        msg += "Only 24-bit uncompressed files are supported.\n";
-        return msg.c_str();
+        return "Invalid or incompatible file.\n"
+            "Only 8-bit, 24-bit and 32-bit uncompressed files "
+            "are supported.\n";
     }
 };
 
@@ -90,756 +256,4104 @@ class IOException : public std::exception {
     }
 };
 
-class BitmapParser {
- private:
-    // Constants for correct images.
-    static const size_t CORRECT_SIG = 0x424d;
-    static const size_t CORRECT_TOTAL_HEADER_SIZE = 0x36;
-    static const size_t CORRECT_INFOHEADER_SIZE = 0x28;
-    static const size_t CORRECT_BITS_PER_PIXEL = 0x18;
-    static const size_t CORRECT_BYTES_PER_PIXEL = 3;
-    static const size_t CORRECT_PLANES = 1;
-    static const size_t CORRECT_COMPRESSION = 0;
-    static const size_t CORRECT_COLORS_USED = 0;
-    static const size_t CORRECT_IMPORTANT_COLORS = 0;
+/*
+Non-owning view of a single row of pixels.
+T is Pixel for a writable row, or const Pixel for a read only row.
+Supports indexing and iteration like the std::vector<Pixel> rows
+that BitmapParser used to hand out.
+*/
+template <typename T>
+class BasicPixelRow {
+ public:
+    BasicPixelRow() : _data(nullptr), _width(0) {}
+    BasicPixelRow(T* data, size_t width) : _data(data), _width(width) {}
+    // Allows a writable row to be passed where a read only row is expected.
+    template <typename U>
+    BasicPixelRow(const BasicPixelRow<U>& other)  // NOLINT(runtime/explicit)
+        : _data(other.data()), _width(other.size()) {}
 
-    // Constants for word/dword size in bytes.
-    static const size_t BYTE = 1;
-    static const size_t WORD = 2;
-    static const size_t DWORD = 4;
+    T& operator[](size_t col) const { return _data[col]; }
+    size_t size() const { return _width; }
+    bool empty() const { return _width == 0; }
+    T* data() const { return _data; }
+    T* begin() const { return _data; }
+    T* end() const { return _data + _width; }
 
-    /*
-    Containers per section of the bitmap file:
-    File pointer, header, infoheader, and pixels vector.
-    */
-    FILE* _fileptr;
-    Header _header;
-    InfoHeader _infoheader;
-    std::vector<std::vector<Pixel> > _pixels;
-    size_t _padding;
+ private:
+    T* _data;
+    size_t _width;
+};
 
-    /* PRIVATE FUNCTION HEADERS */
-    // Wrapper for fread with error handling.
-    void check_read(void* buffer, size_t size, size_t count, FILE* stream);
-    // Wrapper for fwrite with error handling.
-    void check_write(void* buffer, size_t size, size_t count, FILE* stream);
-    // Input and output for the header struct.
-    void import_header();
-    void write_header();
-    // Input and output for the info header struct.
-    void import_infoheader();
-    void write_infoheader();
-    // Check on image compatibility and correctness.
-    bool compatible() const;
+typedef BasicPixelRow<Pixel> PixelRow;
+typedef BasicPixelRow<const Pixel> ConstPixelRow;
 
+/*
+Non-owning 2D view of pixels, indexed as view[row][col].
+Rows are stride pixels apart in memory, which may be wider than
+the view itself when it looks at part of a larger image.
+Iterating over a view yields one row at a time, top to bottom.
+*/
+template <typename T>
+class BasicPixelView {
  public:
-    /* PUBLIC FUNCTION HEADERS */
-    // Constructors.
-    BitmapParser();
-    explicit BitmapParser(const char* filename);
-    explicit BitmapParser(const std::string& filename);
-    // Header accessors and mutators.
-    const Header& read_header() const;
-    Header& header();
-    void replace_header(const Header& new_header);
-    // Info header accessors and mutators.
-    const InfoHeader& read_infoheader() const;
-    InfoHeader& infoheader();
-    void replace_infoheader(const InfoHeader& new_infoheader);
-    // Pixels vector accessors and mutators.
-    const std::vector<std::vector<Pixel> >& read_pixels() const;
-    std::vector<std::vector<Pixel> >& pixels();
-    void replace_pixels(const std::vector<std::vector<Pixel> >& new_pixels);
-    // Padding accessors and mutators.
-    const size_t read_padding() const;
-    size_t padding();
-    void replace_padding(size_t new_padding);
-    // Calculator for row padding.
-    static size_t row_padding(size_t width);
-    size_t row_padding() const;
-    // Calculator for file size.
-    static size_t calculate_size(size_t width, size_t height);
-    size_t calculate_size() const;
-    // Read from a bitmap file.
-    void import(const char* filename);
-    // Write to a bitmap file.
-    void save(const char* filename);
-    // Erase all data.
-    void clear_data();
-    // Print information about the image.
-    void print_metadata(bool hex) const;
-    void print_pixels(bool hex) const;
-    // Image reflections.
-    void flip_horizontal();
-    void flip_vertical();
-    // Image transposition and rotations.
-    void transpose();
-    void rotate90_left();
-    void rotate90_right();
-    // Image cropping.
-    void crop(size_t x_begin, size_t y_begin, size_t x_end, size_t y_end);
-    // Another image on top of this image.
-    void superimpose(const BitmapParser& other,
-        size_t x_begin, size_t y_begin);
-    // Color filters.
-    void invert_colors();
-    void grayscale();
-    void sepia();
-    void isolate_red();
-    void isolate_green();
-    void isolate_blue();
+    // Forward iterator over the rows of the view.
+    class iterator {
+     public:
+        iterator(T* row, size_t width, size_t stride)
+            : _row(row), _width(width), _stride(stride) {}
+        BasicPixelRow<T> operator*() const {
+            return BasicPixelRow<T>(_row, _width);
+        }
+        iterator& operator++() {
+            _row += _stride;
+            return *this;
+        }
+        bool operator==(const iterator& other) const {
+            return _row == other._row;
+        }
+        bool operator!=(const iterator& other) const {
+            return _row != other._row;
+        }
+
+     private:
+        T* _row;
+        size_t _width;
+        size_t _stride;
+    };
+
+    BasicPixelView() : _data(nullptr), _width(0), _height(0), _stride(0) {}
+    BasicPixelView(T* data, size_t width, size_t height, size_t stride)
+        : _data(data), _width(width), _height(height), _stride(stride) {}
+    // Allows a writable view to be passed where a read only one is expected.
+    template <typename U>
+    BasicPixelView(const BasicPixelView<U>& other)  // NOLINT(runtime/explicit)
+        : _data(other.data()), _width(other.width()),
+        _height(other.height()), _stride(other.stride()) {}
+
+    BasicPixelRow<T> operator[](size_t row) const {
+        return BasicPixelRow<T>(_data + row * _stride, _width);
+    }
+    // Number of rows, mirroring the size() of the old vector of rows.
+    size_t size() const { return _height; }
+    bool empty() const { return _width == 0 || _height == 0; }
+    size_t width() const { return _width; }
+    size_t height() const { return _height; }
+    size_t stride() const { return _stride; }
+    T* data() const { return _data; }
+    // True if there are no gaps between rows.
+    bool contiguous() const { return _stride == _width; }
+    // View of part of this view, starting at (col, row). Not checked.
+    BasicPixelView subview(size_t col, size_t row, size_t width,
+        size_t height) const {
+        return BasicPixelView(_data + row * _stride + col, width, height,
+            _stride);
+    }
+    iterator begin() const { return iterator(_data, _width, _stride); }
+    iterator end() const {
+        return iterator(_data + _height * _stride, _width, _stride);
+    }
+
+ private:
+    T* _data;
+    size_t _width;
+    size_t _height;
+    size_t _stride;
 };
 
-/*
-Wrapper for reading and checking fread.
-No need to check return value of fread, since feof/ferror
-flags are set automatically.
-*/
-inline void BitmapParser::check_read(void* buffer,
-    size_t size, size_t count, FILE* stream) {
-    fread(buffer, size, count, stream);
-    if (feof(stream)) throw EOFException();
-    else if (ferror(stream)) throw IOException();
-}
+typedef BasicPixelView<Pixel> PixelView;
+typedef BasicPixelView<const Pixel> ConstPixelView;
 
 /*
-Wrapper for writing and checking fwrite.
-No need to check return value of fwrite, since the ferror
-flag is set automatically.
+Owning storage for the pixels of an image.
+All pixels live in a single allocation, row after row, top to bottom,
+so walking the image is a linear scan through memory.
+T is the pixel type, such as Pixel for a PixelBuffer. The pixels are
+allocated with Allocator, like the elements of a std::vector, and
+buffers made from this one (copies of views, for example) use the
+same allocator.
 */
-inline void BitmapParser::check_write(void* buffer,
-    size_t size, size_t count, FILE* stream) {
-    fwrite(buffer, size, count, stream);
-    if (ferror(stream)) throw IOException();
-}
+template <typename T, typename Allocator = std::allocator<T> >
+class BasicPixelBuffer {
+ public:
+    typedef BasicPixelRow<T> Row;
+    typedef BasicPixelRow<const T> ConstRow;
+    typedef BasicPixelView<T> View;
+    typedef BasicPixelView<const T> ConstView;
+    typedef Allocator allocator_type;
+    typedef std::vector<T, Allocator> Storage;
 
-// Helper method for importing the header.
-void BitmapParser::import_header() {
+    BasicPixelBuffer() : _width(0), _height(0) {}
+    explicit BasicPixelBuffer(const Allocator& alloc)
+        : _data(alloc), _width(0), _height(0) {}
+    BasicPixelBuffer(size_t width, size_t height,
+        const Allocator& alloc = Allocator())
+        : _data(width * height, T(), alloc), _width(width),
+        _height(height) {}
+    // Takes over the pixels of a vector holding width * height pixels.
+    BasicPixelBuffer(Storage&& data, size_t width, size_t height)
+        : _data(std::move(data)), _width(width), _height(height) {
+        if (_data.size() != width * height) {
+            data.swap(_data);
+            throw std::invalid_argument(
+                "Pixel count must be width times height!\n");
+        }
+    }
+    BasicPixelBuffer(const BasicPixelBuffer& other) = default;
+    BasicPixelBuffer& operator=(const BasicPixelBuffer& other) = default;
     /*
-      The signature is the only word.
-      A buffer is needed to switch the endianness
-      for the signature only, so it reads 42 4D not 4D 42.
-      All other fields are little endian.
-      Although the C standard mandates that the size of a char
-      be 1 byte, using sizeof(char) here for readability.
-      Compiler will replace with 1 -- no runtime performance loss.
-      */
-    uint8_t word_buf[WORD];
-    check_read(word_buf, sizeof(char), WORD, _fileptr);
-    _header.signature = static_cast<uint16_t>(word_buf[1]) |
-        (static_cast<uint16_t>(word_buf[0]) << 8);
-    check_read(&(_header.file_size), sizeof(char), DWORD, _fileptr);
-    check_read(&(_header.reserved), sizeof(char), DWORD, _fileptr);
-    check_read(&(_header.data_offset), sizeof(char), DWORD, _fileptr);
-}
-
-// Helper method for writing the header.
-void BitmapParser::write_header() {
+    Moves leave the other buffer empty, with no width or height.
+    Like std::vector, assigning between buffers whose allocators do
+    not compare equal copies the pixels instead.
+    */
+    BasicPixelBuffer(BasicPixelBuffer&& other) noexcept
+        : _data(std::move(other._data)), _width(other._width),
+        _height(other._height) {
+        other.clear();
+    }
+    BasicPixelBuffer& operator=(BasicPixelBuffer&& other) noexcept(
+        std::is_nothrow_move_assignable<Storage>::value) {
+        if (this != &other) {
+            _data = std::move(other._data);
+            _width = other._width;
+            _height = other._height;
+            other.clear();
+        }
+        return *this;
+    }
+    // Copies the pixels of a view, materializing it.
+    explicit BasicPixelBuffer(ConstView view,
+        const Allocator& alloc = Allocator())
+        : _data(view.width() * view.height(), T(), alloc),
+        _width(view.width()), _height(view.height()) {
+        T* dst = _data.data();
+        for (ConstRow row : view) {
+            dst = std::copy(row.begin(), row.end(), dst);
+        }
+    }
+
+    // Changes the dimensions. Pixel values are left unspecified.
+    void resize(size_t width, size_t height) {
+        _data.resize(width * height);
+        _width = width;
+        _height = height;
+    }
+    // Removes all pixels.
+    void clear() {
+        _data.clear();
+        _width = 0;
+        _height = 0;
+    }
     /*
-    No need for bit shifting since it is a write,
-    but a char[] is needed for correct endianness.
+    Replaces the contents with a copy of a view.
+    The view may look into this buffer.
     */
-    char signature[] = "BM";
-    check_write(signature, sizeof(char), WORD, _fileptr);
-    check_write(&(_header.file_size), sizeof(char), DWORD, _fileptr);
-    check_write(&(_header.reserved), sizeof(char), DWORD, _fileptr);
-    check_write(&(_header.data_offset), sizeof(char), DWORD, _fileptr);
-}
+    void assign(ConstView view) {
+        BasicPixelBuffer copy(view, get_allocator());
+        swap(copy);
+    }
+    // Replaces the contents with a copy of a vector of rows.
+    void assign(const std::vector<std::vector<T> >& rows) {
+        const size_t width = rows.empty() ? 0 : rows[0].size();
+        for (const std::vector<T>& row : rows) {
+            if (row.size() != width)
+                throw std::invalid_argument(
+                    "All rows must have the same width!\n");
+        }
+        resize(width, rows.size());
+        T* dst = _data.data();
+        for (const std::vector<T>& row : rows) {
+            dst = std::copy(row.begin(), row.end(), dst);
+        }
+    }
+    // Like std::vector, the allocators must compare equal.
+    void swap(BasicPixelBuffer& other) {
+        _data.swap(other._data);
+        std::swap(_width, other._width);
+        std::swap(_height, other._height);
+    }
+    // Gives up the pixels, row after row, leaving the buffer empty.
+    Storage release() {
+        Storage data(_data.get_allocator());
+        data.swap(_data);
+        clear();
+        return data;
+    }
+    Allocator get_allocator() const { return _data.get_allocator(); }
 
-// Helper method for importing the info header.
-void BitmapParser::import_infoheader() {
-    // Only planes and bits per pixel are words.
-    check_read(&(_infoheader.size), sizeof(char), DWORD, _fileptr);
-    check_read(&(_infoheader.width), sizeof(char), DWORD, _fileptr);
-    check_read(&(_infoheader.height), sizeof(char), DWORD, _fileptr);
-    check_read(&(_infoheader.planes), sizeof(char), WORD, _fileptr);
-    check_read(&(_infoheader.bits_per_pixel), sizeof(char),
-        WORD, _fileptr);
-    check_read(&(_infoheader.compression), sizeof(char), DWORD, _fileptr);
-    check_read(&(_infoheader.image_size), sizeof(char), DWORD, _fileptr);
-    check_read(&(_infoheader.x_pixels_per_meter), sizeof(char),
-        DWORD, _fileptr);
-    check_read(&(_infoheader.y_pixels_per_meter), sizeof(char),
-        DWORD, _fileptr);
-    check_read(&(_infoheader.colors_used), sizeof(char), DWORD, _fileptr);
-    check_read(&(_infoheader.important_colors), sizeof(char),
-        DWORD, _fileptr);
-}
-
-// Helper method for writing the info header.
-void BitmapParser::write_infoheader() {
-    // Only planes and bits per pixel are words.
-    check_write(&(_infoheader.size), sizeof(char), DWORD, _fileptr);
-    check_write(&(_infoheader.width), sizeof(char), DWORD, _fileptr);
-    check_write(&(_infoheader.height), sizeof(char), DWORD, _fileptr);
-    check_write(&(_infoheader.planes), sizeof(char), WORD, _fileptr);
-    check_write(&(_infoheader.bits_per_pixel), sizeof(char),
-        WORD, _fileptr);
-    check_write(&(_infoheader.compression), sizeof(char), DWORD, _fileptr);
-    check_write(&(_infoheader.image_size), sizeof(char), DWORD, _fileptr);
-    check_write(&(_infoheader.x_pixels_per_meter), sizeof(char),
-        DWORD, _fileptr);
-    check_write(&(_infoheader.y_pixels_per_meter), sizeof(char),
-        DWORD, _fileptr);
-    check_write(&(_infoheader.colors_used), sizeof(char), DWORD, _fileptr);
-    check_write(&(_infoheader.important_colors), sizeof(char),
-        DWORD, _fileptr);
-}
+    size_t width() const { return _width; }
+    size_t height() const { return _height; }
+    // Total number of pixels.
+    size_t pixel_count() const { return _data.size(); }
+    bool empty() const { return _data.empty(); }
+    T* data() { return _data.data(); }
+    const T* data() const { return _data.data(); }
+    Row operator[](size_t row) {
+        return Row(_data.data() + row * _width, _width);
+    }
+    ConstRow operator[](size_t row) const {
+        return ConstRow(_data.data() + row * _width, _width);
+    }
+    View view() {
+        return View(_data.data(), _width, _height, _width);
+    }
+    ConstView view() const {
+        return ConstView(_data.data(), _width, _height, _width);
+    }
+
+ private:
+    Storage _data;
+    size_t _width;
+    size_t _height;
+};
+
+typedef BasicPixelBuffer<Pixel> PixelBuffer;
 
 /*
-Helper method for checking file correctness and compatibility.
-Returns true if correct and compatible, false otherwise.
-Not checking image size with relation to width, height, and padding
-since some images have zero bytes appended to them,
-especially ones converted and edited through Photoshop.
-(Adobe appends two 0x00 bytes.)
+Cache of released buffers, so images of the same size can reuse each
+other's memory instead of going back to the heap and faulting in
+fresh pages. Sizes are rounded up to a size class, eight per power of
+two, and released buffers are kept per class until max_cached_bytes
+are cached; anything more is freed. Safe to use from several threads.
 */
-bool BitmapParser::compatible() const {
-    // Check image signature for "BM".
-    if (_header.signature != CORRECT_SIG) return false;
-    // Check for data offset - no palette.
-    else if (_header.data_offset !=
-        CORRECT_TOTAL_HEADER_SIZE) return false;
-    // Check for info header size.
-    else if (_infoheader.size != CORRECT_INFOHEADER_SIZE) return false;
-    // Check for # of image planes.
-    else if (_infoheader.planes != CORRECT_PLANES) return false;
-    // Check for compression.
-    else if (_infoheader.compression != CORRECT_COMPRESSION) return false;
-    // Check for 24 bits per pixel.
-    else if (_infoheader.bits_per_pixel !=
-        CORRECT_BITS_PER_PIXEL) return false;
-    // Check number of colors in palette.
-    else if (_infoheader.colors_used != CORRECT_COLORS_USED) return false;
-    // Check number of important colors.
-    else if (_infoheader.important_colors !=
-        CORRECT_IMPORTANT_COLORS) return false;
-    // All checks passed.
-    else
-        return true;
-}
+class BufferPool {
+ public:
+    explicit BufferPool(size_t max_cached_bytes = size_t(1) << 28);
+    ~BufferPool();
+    // Allocates at least bytes bytes, reusing a cached buffer if any.
+    void* allocate(size_t bytes);
+    // Caches a buffer from allocate(bytes), or frees it if full.
+    void deallocate(void* buffer, size_t bytes);
+    // Frees every cached buffer.
+    void release();
+    // Bytes currently cached, and the most that will be.
+    size_t cached_bytes() const;
+    size_t max_cached_bytes() const;
+    // Pool used by default by PoolAllocator.
+    static BufferPool& shared();
+    // Size of the buffers allocate(bytes) hands out.
+    static size_t size_class(size_t bytes);
 
-// Default constructor.
-BitmapParser::BitmapParser()
-    : _fileptr(nullptr), _header(Header()),
-    _infoheader(InfoHeader()),
-    _pixels(std::vector<std::vector<Pixel> >()),
-    _padding(0) {}
+ private:
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
 
-// Overloaded ctor for C-string filename.
-BitmapParser::BitmapParser(const char* filename)
-    : _fileptr(nullptr), _header(Header()),
-    _infoheader(InfoHeader()),
-    _pixels(std::vector<std::vector<Pixel> >()),
-    _padding(0) {
-    import(filename);
-}
+    const size_t _max_cached_bytes;
+    // Guards everything below.
+    mutable std::mutex _mutex;
+    // Released buffers, by size class.
+    std::map<size_t, std::vector<void*> > _cached;
+    size_t _cached_bytes;
+};
 
-// Overloaded ctor for C++ string filename.
-BitmapParser::BitmapParser(const std::string& filename)
-    : _fileptr(nullptr), _header(Header()),
-    _infoheader(InfoHeader()),
-    _pixels(std::vector<std::vector<Pixel> >()),
-    _padding(0) {
-    import(filename.c_str());
-}
+// Starts with no buffers cached.
+inline BufferPool::BufferPool(size_t max_cached_bytes)
+    : _max_cached_bytes(max_cached_bytes), _cached_bytes(0) {}
 
-// Accessor for header struct.
-const Header& BitmapParser::read_header() const {
-    return _header;
+// Frees the cached buffers. Buffers still in use must not outlive it.
+inline BufferPool::~BufferPool() {
+    release();
 }
 
-// Mutator for header struct as reference.
-Header& BitmapParser::header() {
-    return _header;
+inline void* BufferPool::allocate(size_t bytes) {
+    const size_t size = size_class(bytes);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::map<size_t, std::vector<void*> >::iterator it =
+            _cached.find(size);
+        if (it != _cached.end() && !it->second.empty()) {
+            void* buffer = it->second.back();
+            it->second.pop_back();
+            _cached_bytes -= size;
+            return buffer;
+        }
+    }
+    return ::operator new(size);
 }
 
-// Mutator for replacing header struct.
-void BitmapParser::replace_header(const Header& new_header) {
-    // Shallow copy is fine, no pointers.
-    _header = new_header;
+inline void BufferPool::deallocate(void* buffer, size_t bytes) {
+    const size_t size = size_class(bytes);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_cached_bytes + size <= _max_cached_bytes) {
+            _cached[size].push_back(buffer);
+            _cached_bytes += size;
+            return;
+        }
+    }
+    ::operator delete(buffer);
 }
 
-// Accessor for info header struct.
-const InfoHeader& BitmapParser::read_infoheader() const {
-    return _infoheader;
+inline void BufferPool::release() {
+    std::map<size_t, std::vector<void*> > cached;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        cached.swap(_cached);
+        _cached_bytes = 0;
+    }
+    for (const std::pair<const size_t, std::vector<void*> >& entry :
+        cached) {
+        for (void* buffer : entry.second) ::operator delete(buffer);
+    }
 }
 
-// Mutator for info header struct as reference.
-InfoHeader& BitmapParser::infoheader() {
-    return _infoheader;
+inline size_t BufferPool::cached_bytes() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _cached_bytes;
 }
 
-// Mutator for replacing infoheader struct.
-void BitmapParser::replace_infoheader(const InfoHeader& new_infoheader) {
-    // Shallow copy is fine, no pointers.
-    _infoheader = new_infoheader;
+inline size_t BufferPool::max_cached_bytes() const {
+    return _max_cached_bytes;
 }
 
-// Accessor for pixels.
-const std::vector<std::vector<Pixel> >& BitmapParser::read_pixels() const {
-    return _pixels;
+// Pool shared by every PoolAllocator that is not given one.
+inline BufferPool& BufferPool::shared() {
+    static BufferPool pool;
+    return pool;
 }
 
-// Mutator for pixels vector as reference.
-std::vector<std::vector<Pixel> >& BitmapParser::pixels() {
-    return _pixels;
+/*
+Rounds up to a multiple of an eighth of the largest power of two
+that fits, so at most an eighth of a buffer is wasted. Sizes up to
+64 bytes are rounded up to a multiple of 8.
+*/
+inline size_t BufferPool::size_class(size_t bytes) {
+    if (bytes <= 64) return std::max<size_t>(8, (bytes + 7) & ~size_t(7));
+    size_t power = 64;
+    while (power <= bytes / 2) power *= 2;
+    const size_t step = power / 8;
+    return (bytes + step - 1) / step * step;
 }
 
-// Mutator for replacing pixels vector.
-void BitmapParser::replace_pixels(
-    const std::vector<std::vector<Pixel> >& new_pixels) {
-    // Shallow copy is fine, no pointers.
-    _pixels = new_pixels;
-}
+/*
+Allocator that takes memory from a BufferPool, the shared one unless
+another is given, and gives it back there. Containers that are
+moved, swapped or assigned take the pool along with the memory.
+*/
+template <typename T>
+class PoolAllocator {
+ public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
 
-// Accessor for padding.
-const size_t BitmapParser::read_padding() const {
-    return _padding;
-}
+    PoolAllocator() : _pool(&BufferPool::shared()) {}
+    // Allows a pool to be passed where an allocator is expected.
+    PoolAllocator(BufferPool* pool)  // NOLINT(runtime/explicit)
+        : _pool(pool) {}
+    // Containers rebind allocators implicitly.
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other)  // NOLINT(runtime/explicit)
+        : _pool(other.pool()) {}
 
-// Mutator for padding.
-size_t BitmapParser::padding() {
-    return _padding;
-}
+    T* allocate(size_t count) {
+        return static_cast<T*>(_pool->allocate(count * sizeof(T)));
+    }
+    void deallocate(T* buffer, size_t count) {
+        _pool->deallocate(buffer, count * sizeof(T));
+    }
+    BufferPool* pool() const { return _pool; }
 
-// Mutator for replacing padding.
-void BitmapParser::replace_padding(size_t new_padding) {
-    _padding = new_padding;
+ private:
+    BufferPool* _pool;
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>& lhs, const PoolAllocator<U>& rhs) {
+    return lhs.pool() == rhs.pool();
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>& lhs, const PoolAllocator<U>& rhs) {
+    return lhs.pool() != rhs.pool();
 }
 
+// Pixel buffer whose memory comes from a BufferPool.
+typedef BasicPixelBuffer<Pixel, PoolAllocator<Pixel> > PooledPixelBuffer;
+
 /*
-Returns the number of bytes for row padding for a given width.
-This function is static - it can be used as a padding calculator
-on its own without making an instance of BitmapParser.
+Converts a row of pixels stored in blue, green, red order,
+as in bitmap files, into Pixels.
 */
-size_t BitmapParser::row_padding(size_t width) {
-    // Each row must be a multiple of a dword (4 bytes)
-    size_t remainder = (width * CORRECT_BYTES_PER_PIXEL) % DWORD;
-    if (remainder == 0) {
-        return 0;
-    } else {
-        return (DWORD - remainder);
+inline void bgr_to_pixels(const uint8_t* src, Pixel* dst, size_t width) {
+    for (size_t col = 0; col < width; ++col, src += 3) {
+        dst[col].red = src[2];
+        dst[col].green = src[1];
+        dst[col].blue = src[0];
     }
 }
 
-// Overload: if no parameters are passed, uses current width.
-size_t BitmapParser::row_padding() const {
-    return row_padding(_infoheader.width);
+/*
+Converts a row of Pixels into blue, green, red order,
+as in bitmap files.
+*/
+inline void pixels_to_bgr(const Pixel* src, uint8_t* dst, size_t width) {
+    for (size_t col = 0; col < width; ++col, dst += 3) {
+        dst[0] = src[col].blue;
+        dst[1] = src[col].green;
+        dst[2] = src[col].red;
+    }
 }
 
 /*
-Returns the file size given width and height.
-This function is static - it can be used as a size calculator
-on its own without making an instance of BitmapParser.
+Exchanges the contents of two rows of the same width.
+Goes through a small buffer, so every step is a plain memcpy.
 */
-size_t BitmapParser::calculate_size(size_t width, size_t height) {
-    return ((((CORRECT_BYTES_PER_PIXEL * width) +
-        row_padding(width)) * height) + CORRECT_TOTAL_HEADER_SIZE);
+template <typename T>
+inline void swap_pixel_rows(BasicPixelRow<T> first,
+    BasicPixelRow<T> second) {
+    const size_t CHUNK = 1024;
+    T buffer[CHUNK];
+    for (size_t col = 0; col < first.size(); col += CHUNK) {
+        const size_t bytes =
+            std::min(CHUNK, first.size() - col) * sizeof(T);
+        memcpy(buffer, first.data() + col, bytes);
+        memcpy(first.data() + col, second.data() + col, bytes);
+        memcpy(second.data() + col, buffer, bytes);
+    }
 }
 
-// Overload: if no parameters are passed, uses current width and height.
-size_t BitmapParser::calculate_size() const {
-    return calculate_size(_infoheader.width, _infoheader.height);
+/*
+Copies src into dst with rows and columns swapped, so dst must be
+src.height() wide and src.width() tall. reverse_rows also flips dst
+vertically and reverse_cols flips it horizontally, which turns the
+transpose into a rotation in the same pass.
+The copy goes tile by tile, so the rows of a tile of src stay in
+cache while its columns are written out as rows of dst.
+*/
+template <typename T>
+inline void transpose_pixels(BasicPixelView<const T> src,
+    BasicPixelView<T> dst, bool reverse_rows, bool reverse_cols) {
+    const size_t TILE = 32;
+    const size_t height = src.height();
+    const size_t width = src.width();
+    for (size_t row_begin = 0; row_begin < height; row_begin += TILE) {
+        const size_t row_end = std::min(row_begin + TILE, height);
+        for (size_t col_begin = 0; col_begin < width; col_begin += TILE) {
+            const size_t col_end = std::min(col_begin + TILE, width);
+            for (size_t col = col_begin; col < col_end; ++col) {
+                // Column col of src is one row of dst.
+                T* dst_row = dst[reverse_rows ?
+                    width - 1 - col : col].data();
+                const T* src_pix = src[row_begin].data() + col;
+                for (size_t row = row_begin; row < row_end; ++row) {
+                    dst_row[reverse_cols ? height - 1 - row : row] =
+                        *src_pix;
+                    src_pix += src.stride();
+                }
+            }
+        }
+    }
 }
 
-// Reads and parses a bitmap file.
-void BitmapParser::import(const char* filename) {
-    /*
-    Open and check for success.
-    FYI - Visual Studio debugger requires absolute path.
-    */
-    _fileptr = fopen(filename, "rb");
-    if (_fileptr == nullptr) throw FileOpenException();
-    // Import the header and info header via helpers.
-    import_header();
-    import_infoheader();
-    // Calculate row padding via helper.
-    _padding = row_padding();
-    // Check correctness and compatibility of the image.
-    if (!compatible()) throw InvalidFormatException();
-    // Create vectors of Pixels by height (# of rows).
-    _pixels.resize(_infoheader.height);
-    // Reserve in each row for future Pixel push_back.
-    for (std::vector<Pixel>& row : _pixels) {
-        row.reserve(_infoheader.width);
+/*
+COLOR FILTER KERNELS
+Each kernel filters count Pixels stored back to back.
+Pixels are packed three bytes each, so the vector kernels work on the
+raw bytes, and their results are identical to the scalar kernels.
+*/
+
+// Inverts every channel.
+inline void invert_pixels_scalar(Pixel* pixels, size_t count) {
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+    for (size_t i = 0; i < count * 3; ++i) bytes[i] = 0xff - bytes[i];
+}
+
+/*
+Replaces every channel by the average of the three channels.
+(r + g + b) / 3 equals the sum of each channel's quotient and
+remainder divided separately, and for sums up to 765 the division
+is exact as a multiply by 0xAAAB and a shift by 17.
+*/
+inline void grayscale_pixels_scalar(Pixel* pixels, size_t count) {
+    for (Pixel* pix = pixels; pix != pixels + count; ++pix) {
+        const uint32_t sum = pix->red + pix->green + pix->blue;
+        const uint8_t avg = static_cast<uint8_t>((sum * 0xAAABu) >> 17);
+        pix->red = avg;
+        pix->green = avg;
+        pix->blue = avg;
     }
-    /*
-    Finally, read the pixels bottom-up. The start of the file
-    after the header/info header contains the bottom left pixel.
-    Pixels are stored in blue, green, red order.
-    Using int for row due to complications with decrementing for loops
-    and unsigned values.
-    */
-    for (int row = _pixels.size() - 1; row >= 0; --row) {
-        for (size_t col = 0; col < _infoheader.width; ++col) {
-            // Read R, G, B for each pixel.
-            Pixel pix = {};
-            check_read(&(pix.blue), sizeof(char), BYTE, _fileptr);
-            check_read(&(pix.green), sizeof(char), BYTE, _fileptr);
-            check_read(&(pix.red), sizeof(char), BYTE, _fileptr);
-            _pixels[row].push_back(pix);
+}
+
+/*
+Sepia filter on one set of channels in double precision,
+using Microsoft's ratios.
+*/
+inline void sepia_channels_double(uint8_t* red, uint8_t* green,
+    uint8_t* blue) {
+    const double MAX_VAL = 255.0;
+    double float_red = 0.393 * *red + 0.769 * *green + 0.189 * *blue;
+    double float_green = 0.349 * *red + 0.686 * *green + 0.168 * *blue;
+    double float_blue = 0.272 * *red + 0.534 * *green + 0.131 * *blue;
+    // If greater than 255, bring it down.
+    if (float_red > MAX_VAL) float_red = MAX_VAL;
+    if (float_green > MAX_VAL) float_green = MAX_VAL;
+    if (float_blue > MAX_VAL) float_blue = MAX_VAL;
+    // Then cast to uint8_t.
+    *red = (uint8_t)float_red;
+    *green = (uint8_t)float_green;
+    *blue = (uint8_t)float_blue;
+}
+
+// Sepia filter on one pixel in double precision.
+inline void sepia_pixel_double(Pixel* pix) {
+    sepia_channels_double(&pix->red, &pix->green, &pix->blue);
+}
+
+/*
+True if a sepia channel in thousandths may come out differently in
+double precision. The ratios have three decimal places, so a channel
+is exactly x / 1000 for an integer x, which the double formula then
+truncates. When x is a nonzero multiple of 1000, rounding can leave
+the double just under the integer. Any other x is at least 0.001
+away from an integer, far more than the rounding error.
+*/
+inline bool sepia_inexact(uint32_t thousandths) {
+    return thousandths != 0 && thousandths % 1000 == 0;
+}
+
+/*
+Sepia filter in fixed point, identical to sepia_pixel_double.
+Channels are computed in thousandths with integer weights, and the
+rare pixels where that could differ go through the double formula.
+*/
+inline void sepia_pixels_scalar(Pixel* pixels, size_t count) {
+    const uint32_t MAX_VAL = 255;
+    for (Pixel* pix = pixels; pix != pixels + count; ++pix) {
+        const uint32_t red = 393 * pix->red + 769 * pix->green
+            + 189 * pix->blue;
+        const uint32_t green = 349 * pix->red + 686 * pix->green
+            + 168 * pix->blue;
+        const uint32_t blue = 272 * pix->red + 534 * pix->green
+            + 131 * pix->blue;
+        if (sepia_inexact(red) || sepia_inexact(green) ||
+            sepia_inexact(blue)) {
+            sepia_pixel_double(pix);
+            continue;
         }
-        // Skip the row padding before moving to the next row.
-        fseek(_fileptr, _padding, SEEK_CUR);
+        pix->red = static_cast<uint8_t>(std::min(red / 1000, MAX_VAL));
+        pix->green = static_cast<uint8_t>(std::min(green / 1000, MAX_VAL));
+        pix->blue = static_cast<uint8_t>(std::min(blue / 1000, MAX_VAL));
     }
-    // Close the file.
-    fclose(_fileptr);
 }
 
-// Writes a bitmap file.
-void BitmapParser::save(const char* filename) {
-    // Filler zero byte for padding.
-    uint8_t padding_byte = 0x0;
-    /*
-     Open and check for success.
-     FYI - Visual Studio debugger requires absolute path.
-     */
-    _fileptr = fopen(filename, "wb");
-    if (_fileptr == nullptr) throw FileOpenException();
-    // Write the header and info header via helpers.
-    write_header();
-    write_infoheader();
-    /*
-    Finally, write the pixels bottom-up. The start of the file
-    after the header/info header should contain the bottom left pixel.
-    Pixels must be written in blue, green, red order.
-    Using int for row due to complications with decrementing for loops
-    and unsigned values.
-    */
-    for (int row = _pixels.size() - 1; row >= 0; --row) {
-        for (size_t col = 0; col < _infoheader.width; ++col) {
-            // Write R, G, B for each pixel.
-            Pixel& pix = _pixels[row][col];
-            check_write(&(pix.blue), sizeof(char), BYTE, _fileptr);
-            check_write(&(pix.green), sizeof(char), BYTE, _fileptr);
-            check_write(&(pix.red), sizeof(char), BYTE, _fileptr);
-        }
-        // Write row padding before moving to the next row.
-        check_write(&(padding_byte), sizeof(char), _padding, _fileptr);
+// Bitwise ANDs every pixel with mask, 0xff keeping a channel.
+inline void mask_pixels_scalar(Pixel* pixels, size_t count,
+    const Pixel& mask) {
+    for (Pixel* pix = pixels; pix != pixels + count; ++pix) {
+        pix->red &= mask.red;
+        pix->green &= mask.green;
+        pix->blue &= mask.blue;
     }
-    // Close the file.
-    fclose(_fileptr);
 }
 
-// Clears all state stored in this instance.
-void BitmapParser::clear_data() {
-    _fileptr = nullptr;
-    _header = Header();
-    _infoheader = InfoHeader();
-    _pixels.clear();
-    _padding = 0;
+#ifdef BITMAPPARSER_HAS_X86_SIMD
+// Inverts 16 bytes at a time.
+BITMAPPARSER_TARGET("sse2")
+inline void invert_pixels_sse2(Pixel* pixels, size_t count) {
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+    const size_t size = count * 3;
+    const __m128i ones = _mm_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i* p = reinterpret_cast<__m128i*>(bytes + i);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), ones));
+    }
+    for (; i < size; ++i) bytes[i] = 0xff - bytes[i];
 }
 
-// Prints information about the header and info header.
-void BitmapParser::print_metadata(bool hex) const {
-    // For displaying text dividers.
-    const std::string div = "========================================";
-    if (hex) {
-        std::cout << "Number base: hexadecimal\n\n";
-    } else {
-        std::cout << "Number base: decimal\n\n";
+// Inverts 32 bytes at a time.
+BITMAPPARSER_TARGET("avx2")
+inline void invert_pixels_avx2(Pixel* pixels, size_t count) {
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+    const size_t size = count * 3;
+    const __m256i ones = _mm256_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i* p = reinterpret_cast<__m256i*>(bytes + i);
+        _mm256_storeu_si256(p,
+            _mm256_xor_si256(_mm256_loadu_si256(p), ones));
     }
-    std::cout << "HEADER\n" << div <<
-        "\nSignature (hexadecimal): 0x" <<
-        std::hex << _header.signature;
-    // Determine hex or decimal.
-    if (!hex) std::cout << std::dec;
-    std::cout << "\nFile Size (Bytes): " <<
-        _header.file_size <<
-        "\nReserved Flags: " <<
-        _header.reserved <<
-        "\nData Offset (Bytes): " <<
-        _header.data_offset <<
-        "\n\nINFO HEADER\n" << div <<
-        "\nInfo Header Size (Bytes): " <<
-        _infoheader.size <<
-        "\nImage Width (Pixels): " <<
-        _infoheader.width <<
-        "\nImage Height (Pixels): " <<
-        _infoheader.height <<
-        "\nPlanes: " <<
-        _infoheader.planes <<
-        "\nBits Per Pixel: " <<
-        _infoheader.bits_per_pixel <<
-        "\nCompression Type: " <<
-        _infoheader.compression <<
-        "\nCompressed Image Size (Bytes): " <<
-        _infoheader.image_size <<
-        "\nHorizontal Resolution (Pixels/Meter): " <<
-        _infoheader.x_pixels_per_meter <<
-        "\nVertical Resolution (Pixels/Meter): " <<
-        _infoheader.y_pixels_per_meter <<
-        "\nNumber of Actually Used Colors: " <<
-        _infoheader.colors_used <<
-        "\nNumber of Important Colors: " <<
-        _infoheader.important_colors << "\n\n";
+    for (; i < size; ++i) bytes[i] = 0xff - bytes[i];
 }
 
 /*
-Prints information about pixels, by row. Lists padding as well.
-Output may be long - recommended to pipe to file.
+Masks 48 bytes (16 pixels) at a time. The mask repeats every
+three bytes, so three vectors cover one period.
 */
-void BitmapParser::print_pixels(bool hex) const {
-    if (hex) {
-        std::cout << "Number base: hexadecimal\n\n";
-    } else {
-        std::cout << "Number base: decimal\n\n";
+BITMAPPARSER_TARGET("sse2")
+inline void mask_pixels_sse2(Pixel* pixels, size_t count,
+    const Pixel& mask) {
+    const uint8_t pattern[3] = {mask.red, mask.green, mask.blue};
+    uint8_t lanes[48];
+    for (size_t i = 0; i < 48; ++i) lanes[i] = pattern[i % 3];
+    const __m128i m0 = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(lanes));
+    const __m128i m1 = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(lanes + 16));
+    const __m128i m2 = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(lanes + 32));
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i* p = reinterpret_cast<__m128i*>(bytes + i * 3);
+        _mm_storeu_si128(p, _mm_and_si128(_mm_loadu_si128(p), m0));
+        _mm_storeu_si128(p + 1, _mm_and_si128(_mm_loadu_si128(p + 1), m1));
+        _mm_storeu_si128(p + 2, _mm_and_si128(_mm_loadu_si128(p + 2), m2));
     }
-    for (size_t row = 0; row < _infoheader.height; ++row) {
-        std::cout << std::dec << "Row " << row << " (R/G/B)" <<
-            "\n==============================\n";
-        for (size_t col = 0; col < _infoheader.width; ++col) {
-            const Pixel& pix = _pixels[row][col];
-            std::cout << std::dec << "Col " << col << ":\t\t";
-            if (hex) std::cout << std::hex;
-            // Cout can't print uint8_t without unsigned().
-            std::cout << unsigned(pix.red) << ' ' <<
-                unsigned(pix.green) << ' ' <<
-                unsigned(pix.blue) << '\n';
-        }
-        // Padding is 0-3 bytes, same notation in decimal and hex.
-        std::cout << "Padding Bytes: " << _padding << "\n\n";
+    mask_pixels_scalar(pixels + i, count - i, mask);
+}
+
+// Masks 96 bytes (32 pixels) at a time.
+BITMAPPARSER_TARGET("avx2")
+inline void mask_pixels_avx2(Pixel* pixels, size_t count,
+    const Pixel& mask) {
+    const uint8_t pattern[3] = {mask.red, mask.green, mask.blue};
+    uint8_t lanes[96];
+    for (size_t i = 0; i < 96; ++i) lanes[i] = pattern[i % 3];
+    const __m256i m0 = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(lanes));
+    const __m256i m1 = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(lanes + 32));
+    const __m256i m2 = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(lanes + 64));
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i* p = reinterpret_cast<__m256i*>(bytes + i * 3);
+        _mm256_storeu_si256(p,
+            _mm256_and_si256(_mm256_loadu_si256(p), m0));
+        _mm256_storeu_si256(p + 1,
+            _mm256_and_si256(_mm256_loadu_si256(p + 1), m1));
+        _mm256_storeu_si256(p + 2,
+            _mm256_and_si256(_mm256_loadu_si256(p + 2), m2));
     }
+    mask_pixels_scalar(pixels + i, count - i, mask);
 }
 
-// Flips the image horizontally.
-void BitmapParser::flip_horizontal() {
-    for (std::vector<Pixel>& row : _pixels) {
-        std::reverse(row.begin(), row.end());
+/*
+Grayscale on four pixels in the low 12 bytes of v.
+Each channel is spread into 16-bit lanes and summed, the sum is
+divided by 3 with the same multiply and shift as the scalar kernel,
+and the average is spread back over the three channels.
+The top 4 bytes of v are returned unchanged.
+*/
+BITMAPPARSER_TARGET("ssse3")
+inline __m128i grayscale_block_ssse3(__m128i v) {
+    const __m128i red = _mm_setr_epi8(0, -1, 3, -1, 6, -1, 9, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i green = _mm_setr_epi8(1, -1, 4, -1, 7, -1, 10, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i blue = _mm_setr_epi8(2, -1, 5, -1, 8, -1, 11, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i spread = _mm_setr_epi8(0, 0, 0, 2, 2, 2, 4, 4, 4,
+        6, 6, 6, -1, -1, -1, -1);
+    const __m128i tail = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, -1, -1, -1, -1);
+    const __m128i sum = _mm_add_epi16(
+        _mm_add_epi16(_mm_shuffle_epi8(v, red), _mm_shuffle_epi8(v, green)),
+        _mm_shuffle_epi8(v, blue));
+    const __m128i avg = _mm_srli_epi16(
+        _mm_mulhi_epu16(sum, _mm_set1_epi16(static_cast<int16_t>(0xAAAB))),
+        1);
+    return _mm_or_si128(_mm_shuffle_epi8(avg, spread),
+        _mm_and_si128(v, tail));
+}
+
+// Grayscale on 4 pixels at a time.
+BITMAPPARSER_TARGET("ssse3")
+inline void grayscale_pixels_ssse3(Pixel* pixels, size_t count) {
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+    size_t i = 0;
+    // Each block reads 16 bytes but only changes the first 12.
+    for (; (i + 4) * 3 + 4 <= count * 3; i += 4) {
+        __m128i* p = reinterpret_cast<__m128i*>(bytes + i * 3);
+        _mm_storeu_si128(p, grayscale_block_ssse3(_mm_loadu_si128(p)));
     }
+    grayscale_pixels_scalar(pixels + i, count - i);
 }
 
-// Flips the image vertically.
-void BitmapParser::flip_vertical() {
-    /*
-    Unable to use std::reverse here due to the
-    pixels in one column being in different vectors.
-    */
-    for (size_t col = 0; col < _pixels[0].size(); ++col) {
-        size_t start_idx = 0;
-        size_t end_idx = _pixels.size() - 1;
-        while (start_idx < end_idx) {
-            std::swap(_pixels[start_idx][col], _pixels[end_idx][col]);
-            ++start_idx;
-            --end_idx;
-        }
+/*
+Grayscale on 8 pixels at a time, four in each 128-bit lane.
+Same steps as grayscale_block_ssse3, which works lane by lane.
+*/
+BITMAPPARSER_TARGET("avx2")
+inline void grayscale_pixels_avx2(Pixel* pixels, size_t count) {
+    const __m256i red = _mm256_setr_epi8(0, -1, 3, -1, 6, -1, 9, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, 0, -1, 3, -1, 6, -1, 9, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i green = _mm256_setr_epi8(1, -1, 4, -1, 7, -1, 10, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, 1, -1, 4, -1, 7, -1, 10, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i blue = _mm256_setr_epi8(2, -1, 5, -1, 8, -1, 11, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, 2, -1, 5, -1, 8, -1, 11, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 2, 2, 2, 4, 4, 4,
+        6, 6, 6, -1, -1, -1, -1, 0, 0, 0, 2, 2, 2, 4, 4, 4,
+        6, 6, 6, -1, -1, -1, -1);
+    const __m256i tail = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, -1, -1, -1, -1);
+    const __m256i third = _mm256_set1_epi16(static_cast<int16_t>(0xAAAB));
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+    size_t i = 0;
+    // The second lane starts at the fifth pixel, 12 bytes in.
+    for (; (i + 8) * 3 + 4 <= count * 3; i += 8) {
+        __m128i* lo = reinterpret_cast<__m128i*>(bytes + i * 3);
+        __m128i* hi = reinterpret_cast<__m128i*>(bytes + i * 3 + 12);
+        const __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(lo)),
+            _mm_loadu_si128(hi), 1);
+        const __m256i sum = _mm256_add_epi16(
+            _mm256_add_epi16(_mm256_shuffle_epi8(v, red),
+            _mm256_shuffle_epi8(v, green)), _mm256_shuffle_epi8(v, blue));
+        const __m256i avg = _mm256_srli_epi16(
+            _mm256_mulhi_epu16(sum, third), 1);
+        const __m256i result = _mm256_or_si256(
+            _mm256_shuffle_epi8(avg, spread), _mm256_and_si256(v, tail));
+        // The low lane keeps the old bytes the high lane overwrites.
+        _mm_storeu_si128(lo, _mm256_castsi256_si128(result));
+        _mm_storeu_si128(hi, _mm256_extracti128_si256(result, 1));
     }
+    grayscale_pixels_scalar(pixels + i, count - i);
 }
 
 /*
-Transposes the image. The nth row becomes the nth column,
-and vice versa. Preliminary step for rotation.
+One sepia channel for eight pixels in 32-bit lanes.
+rg holds red and green as 16-bit pairs and b0 holds blue, so the
+weighted sum in thousandths is two multiply-adds. It is clamped to
+255000, then divided by 1000 as (x / 8) * 134218 / 2^24, which is
+exact over that range. Lanes that sepia_inexact would flag are
+set in inexact.
 */
-void BitmapParser::transpose() {
-    // New pixels vector with width and height interchanged.
-    std::vector<std::vector<Pixel> > new_pixels(_infoheader.width,
-        std::vector<Pixel>(_infoheader.height));
-    // Copy elements in transposed order.
-    for (size_t row = 0; row < _infoheader.height; ++row) {
-        for (size_t col = 0; col < _infoheader.width; ++col) {
-            new_pixels[col][row] = _pixels[row][col];
+BITMAPPARSER_TARGET("avx2")
+inline __m256i sepia_channel_avx2(__m256i rg, __m256i b0,
+    int red_weight, int green_weight, int blue_weight, __m256i* inexact) {
+    const __m256i thousandths = _mm256_add_epi32(
+        _mm256_madd_epi16(rg, _mm256_set1_epi32(
+            red_weight | (green_weight << 16))),
+        _mm256_madd_epi16(b0, _mm256_set1_epi32(blue_weight)));
+    const __m256i clamped = _mm256_min_epu32(thousandths,
+        _mm256_set1_epi32(255000));
+    const __m256i quotient = _mm256_srli_epi32(_mm256_mullo_epi32(
+        _mm256_srli_epi32(clamped, 3), _mm256_set1_epi32(134218)), 24);
+    const __m256i multiple = _mm256_cmpeq_epi32(thousandths,
+        _mm256_mullo_epi32(quotient, _mm256_set1_epi32(1000)));
+    const __m256i zero = _mm256_cmpeq_epi32(thousandths,
+        _mm256_setzero_si256());
+    *inexact = _mm256_or_si256(*inexact,
+        _mm256_andnot_si256(zero, multiple));
+    return quotient;
+}
+
+/*
+Sepia on 8 pixels at a time, four in each 128-bit lane, laid out
+like grayscale_pixels_avx2. If any pixel needs the double formula,
+the whole block goes through the scalar kernel.
+*/
+BITMAPPARSER_TARGET("avx2")
+inline void sepia_pixels_avx2(Pixel* pixels, size_t count) {
+    const __m256i rg = _mm256_setr_epi8(0, -1, 1, -1, 3, -1, 4, -1,
+        6, -1, 7, -1, 9, -1, 10, -1, 0, -1, 1, -1, 3, -1, 4, -1,
+        6, -1, 7, -1, 9, -1, 10, -1);
+    const __m256i b0 = _mm256_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1,
+        8, -1, -1, -1, 11, -1, -1, -1, 2, -1, -1, -1, 5, -1, -1, -1,
+        8, -1, -1, -1, 11, -1, -1, -1);
+    const __m256i to_red = _mm256_setr_epi8(0, -1, -1, 4, -1, -1, 8, -1,
+        -1, 12, -1, -1, -1, -1, -1, -1, 0, -1, -1, 4, -1, -1, 8, -1,
+        -1, 12, -1, -1, -1, -1, -1, -1);
+    const __m256i to_green = _mm256_setr_epi8(-1, 0, -1, -1, 4, -1, -1, 8,
+        -1, -1, 12, -1, -1, -1, -1, -1, -1, 0, -1, -1, 4, -1, -1, 8,
+        -1, -1, 12, -1, -1, -1, -1, -1);
+    const __m256i to_blue = _mm256_setr_epi8(-1, -1, 0, -1, -1, 4, -1, -1,
+        8, -1, -1, 12, -1, -1, -1, -1, -1, -1, 0, -1, -1, 4, -1, -1,
+        8, -1, -1, 12, -1, -1, -1, -1);
+    const __m256i tail = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, -1, -1, -1, -1);
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+    size_t i = 0;
+    for (; (i + 8) * 3 + 4 <= count * 3; i += 8) {
+        __m128i* lo = reinterpret_cast<__m128i*>(bytes + i * 3);
+        __m128i* hi = reinterpret_cast<__m128i*>(bytes + i * 3 + 12);
+        const __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(lo)),
+            _mm_loadu_si128(hi), 1);
+        const __m256i red_green = _mm256_shuffle_epi8(v, rg);
+        const __m256i blue_zero = _mm256_shuffle_epi8(v, b0);
+        __m256i inexact = _mm256_setzero_si256();
+        const __m256i red = sepia_channel_avx2(red_green, blue_zero,
+            393, 769, 189, &inexact);
+        const __m256i green = sepia_channel_avx2(red_green, blue_zero,
+            349, 686, 168, &inexact);
+        const __m256i blue = sepia_channel_avx2(red_green, blue_zero,
+            272, 534, 131, &inexact);
+        if (!_mm256_testz_si256(inexact, inexact)) {
+            sepia_pixels_scalar(pixels + i, 8);
+            continue;
         }
+        const __m256i result = _mm256_or_si256(
+            _mm256_or_si256(_mm256_shuffle_epi8(red, to_red),
+            _mm256_shuffle_epi8(green, to_green)),
+            _mm256_or_si256(_mm256_shuffle_epi8(blue, to_blue),
+            _mm256_and_si256(v, tail)));
+        // The low lane keeps the old bytes the high lane overwrites.
+        _mm_storeu_si128(lo, _mm256_castsi256_si128(result));
+        _mm_storeu_si128(hi, _mm256_extracti128_si256(result, 1));
     }
-    // Replace the pixels vector.
-    _pixels = new_pixels;
-    // Change width and height.
-    std::swap(_infoheader.width, _infoheader.height);
-    // Replace the padding, now that width is changed
-    _padding = row_padding();
-    /*
-    Calculate and change file size, may differ
-    due to row padding.
-    */
-    _header.file_size = calculate_size();
+    sepia_pixels_scalar(pixels + i, count - i);
 }
 
-// Rotates the image 90 degrees counterclockwise.
-void BitmapParser::rotate90_left() {
-    transpose();
-    // Then reverse the rows.
-    flip_vertical();
+// Checks whether the running CPU supports an instruction set.
+inline bool cpu_supports_sse2() {
+#if defined(__x86_64__) || defined(_M_X64)
+    // Always there on x86-64.
+    return true;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
 }
 
-// Rotates the image 90 degrees clockwise.
-void BitmapParser::rotate90_right() {
-    transpose();
-    // Then reverse the columns.
-    flip_horizontal();
+inline bool cpu_supports_ssse3() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+inline bool cpu_supports_avx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    // The OS must also save the AVX registers.
+    const bool os_avx = (info[2] & (1 << 27)) &&
+        (_xgetbv(0) & 0x6) == 0x6;
+    __cpuid(info, 0);
+    if (!os_avx || info[0] < 7) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
 }
+#endif  // BITMAPPARSER_HAS_X86_SIMD
 
 /*
-Crops the subset of _pixels from [x_begin, x_end] [y_begin, y_end].
-Indices are inclusive.
-Adjusts for metadata changes accordingly, which are:
-Header - file size
-Info Header - width and height
-(Since no compression is assumed, image size can remain zero.)
+Pool of worker threads that splits a range of rows into bands.
+run() hands the bands out to the workers and to the calling thread,
+and returns once every band is done. If a task throws, the first
+exception is rethrown by run() after the other bands finish.
+The pool grows when asked for more bands than it has threads,
+and the workers are reused.
+Calls to run() from different threads take turns; calling run()
+from inside a task deadlocks.
 */
-void BitmapParser::crop(size_t x_begin, size_t y_begin,
-    size_t x_end, size_t y_end) {
+class RowBandScheduler {
+ public:
+    // Task for the rows [row_begin, row_end).
+    typedef std::function<void(size_t row_begin, size_t row_end)> Task;
+
+    // threads counts the calling thread, so threads - 1 are started.
+    explicit RowBandScheduler(size_t threads);
+    ~RowBandScheduler();
+    // The workers are owned, so copying is not allowed.
+    RowBandScheduler(const RowBandScheduler&) = delete;
+    RowBandScheduler& operator=(const RowBandScheduler&) = delete;
+
+    // Number of threads that can run bands at once.
+    size_t threads() const;
+    // Starts more workers, so that at least threads can run at once.
+    void reserve(size_t threads);
+    // Splits rows into up to bands bands and runs task on each.
+    void run(size_t rows, size_t bands, const Task& task);
     /*
-    Sanity check on indices. If negative ints are passed and casted
-    to size_t they will overflow, so only four checks are needed:
-    1. x_begin and x_end are smaller than the width.
-    2. x_begin is smaller or equal to x_end.
-    3. y_begin and y_end are smaller than the height.
-    4. y_begin is smaller or equal to y_end.
+    Scheduler with one thread per hardware thread, started on first use.
+    Every multithreaded filter, import and save in the process runs on
+    it, so they take turns even for different images, and a task must
+    not use it itself.
     */
-    if (!(x_begin < _infoheader.width && x_end < _infoheader.width))
-        throw std::out_of_range(
-            "x_begin and x_end must be smaller than width!\n");
-    else if (!(x_begin <= x_end))
-        throw std::out_of_range(
-            "x_begin must be smaller than or equal to x_end!\n");
-    else if (!(y_begin < _infoheader.height && y_end < _infoheader.height))
-        throw std::out_of_range(
-            "y_begin and y_end must be smaller than height!\n");
-    else if (!(y_begin <= y_end))
-        throw std::out_of_range(
-            "y_begin must be smaller than or equal to y_end!\n");
-    // Sanity checks passed, begin cropping.
-    const size_t new_width = x_end - x_begin;
-    const size_t new_height = y_end - y_begin;
-    // In-place cropping using vector's range constructor.
-    _pixels = std::vector<std::vector<Pixel> >(_pixels.begin() + y_begin,
-        _pixels.begin() + y_begin + new_height);
-    for (std::vector<Pixel>& row : _pixels) {
-        row = std::vector<Pixel>(row.begin() + x_begin,
-            row.begin() + x_begin + new_width);
+    static RowBandScheduler& shared();
+    // Thread count to ask of shared(), from 1 up to the hardware threads.
+    static size_t shared_threads(size_t threads);
+
+ private:
+    // Runs bands until none are left. Called with _mutex locked.
+    void run_bands(std::unique_lock<std::mutex>* lock);
+    // Worker thread loop.
+    void work();
+
+    std::vector<std::thread> _workers;
+    // Serializes calls to run().
+    std::mutex _run_mutex;
+    // Guards everything below.
+    mutable std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    const Task* _task;
+    size_t _rows;
+    size_t _bands;
+    size_t _next_band;
+    size_t _finished_bands;
+    // First exception thrown by a task in the current run.
+    std::exception_ptr _error;
+    bool _stopping;
+};
+
+// Starts threads - 1 workers.
+inline RowBandScheduler::RowBandScheduler(size_t threads)
+    : _task(nullptr), _rows(0), _bands(0), _next_band(0),
+    _finished_bands(0), _stopping(false) {
+    reserve(threads);
+}
+
+// Stops and joins the workers.
+inline RowBandScheduler::~RowBandScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
     }
-    // Change width and height
-    _infoheader.width = new_width;
-    _infoheader.height = new_height;
-    // Replace the padding, now that width is changed
-    _padding = row_padding();
-    // Calculate and change file size
-    _header.file_size = calculate_size();
+    _wake.notify_all();
+    for (std::thread& worker : _workers) worker.join();
 }
 
 /*
-Superimposes another BitmapParser instance's image
-onto this instance's image at the desired position.
+Scheduler shared by every BitmapParser. _run_mutex lets one run()
+through at a time, so a filter, import or save on one image waits for
+those on any other image to finish. Calling it from inside one of its
+own band tasks never returns, since the outer run() holds _run_mutex.
 */
-void BitmapParser::superimpose(const BitmapParser& other,
-    size_t x_begin, size_t y_begin) {
-    /*
-    Sanity check on indices. Negative ints passed will overflow,
-    so check just for the following:
-    1. x_begin + <width of other image> is smaller than this->width.
-    2. x_begin is smaller than this->width
-    (to account for overflow when other image width is added.)
-    3. y_begin + <height of other image> is smaller than this->height.
-    4. y_begin is smaller than this->height
-    (to account for overflow when other image height is added.)
-    */
-    if (!(x_begin < _infoheader.width && y_begin < _infoheader.height))
-        throw std::out_of_range(
-            "Invalid starting position!\n");
-    else if (!(x_begin + other._infoheader.width < _infoheader.width))
-        // Able to access other's privates because same class
-        throw std::out_of_range(
-            "Width of superimposed image exceeds original!\n");
-    else if (!(y_begin + other._infoheader.height < _infoheader.height))
-        throw std::out_of_range(
-            "Height of superimposed image exceeds original!\n");
-    // Sanity checks passed, begin superimposing.
-    size_t row_idx = y_begin;
-    size_t col_idx = x_begin;
-    for (const std::vector<Pixel>& row : other._pixels) {
-        for (const Pixel& pix : row) {
-            _pixels[row_idx][col_idx] = pix;
-            ++col_idx;
-        }
-        ++row_idx;
-        col_idx = x_begin;
+inline RowBandScheduler& RowBandScheduler::shared() {
+    static RowBandScheduler scheduler(shared_threads(0));
+    return scheduler;
+}
+
+/*
+Zero means every hardware thread. Larger counts are cut down to
+the hardware threads, so shared() never grows past its first size.
+*/
+inline size_t RowBandScheduler::shared_threads(size_t threads) {
+    const size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    if (threads == 0) return hardware;
+    return std::min(threads, hardware);
+}
+
+// Number of threads, counting the one calling run().
+inline size_t RowBandScheduler::threads() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _workers.size() + 1;
+}
+
+// Starts workers until threads can run at once.
+inline void RowBandScheduler::reserve(size_t threads) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    while (_workers.size() + 1 < threads) {
+        _workers.push_back(std::thread(&RowBandScheduler::work, this));
     }
-    // Image dimensions are identical, nothing to do.
 }
 
-// Inverts the colors of the image.
-void BitmapParser::invert_colors() {
-    const uint8_t color_max = 0xff;
-    for (std::vector<Pixel>& row : _pixels) {
-        for (Pixel& pix : row) {
-            pix.red = color_max - pix.red;
-            pix.green = color_max - pix.green;
-            pix.blue = color_max - pix.blue;
-        }
+/*
+Splits [0, rows) into bands of nearly equal height and runs task
+on each of them. Blocks until every band is done.
+*/
+inline void RowBandScheduler::run(size_t rows, size_t bands, const Task& task) {
+    bands = std::min(bands, rows);
+    if (bands <= 1) {
+        if (rows > 0) task(0, rows);
+        return;
     }
+    std::lock_guard<std::mutex> run_lock(_run_mutex);
+    reserve(bands);
+    std::unique_lock<std::mutex> lock(_mutex);
+    _task = &task;
+    _rows = rows;
+    _bands = bands;
+    _next_band = 0;
+    _finished_bands = 0;
+    _wake.notify_all();
+    // The calling thread helps out, then waits for the rest.
+    run_bands(&lock);
+    _done.wait(lock, [this] { return _finished_bands == _bands; });
+    _task = nullptr;
+    _bands = 0;
+    _next_band = 0;
+    // Pass on the first failure, if any.
+    std::exception_ptr error = _error;
+    _error = nullptr;
+    if (error) std::rethrow_exception(error);
 }
 
-// Turns the image into grayscale using the average method.
-void BitmapParser::grayscale() {
-    for (std::vector<Pixel>& row : _pixels) {
-        for (Pixel& pix : row) {
-            // Average algorithm without overflow.
-            const uint8_t avg = (pix.red / CORRECT_BYTES_PER_PIXEL) +
-                (pix.green / CORRECT_BYTES_PER_PIXEL) +
-                (pix.blue / CORRECT_BYTES_PER_PIXEL) +
-                (((pix.red % CORRECT_BYTES_PER_PIXEL) +
-                (pix.green % CORRECT_BYTES_PER_PIXEL) +
-                    (pix.blue % CORRECT_BYTES_PER_PIXEL)) /
-                    CORRECT_BYTES_PER_PIXEL);
-            pix.red = avg;
-            pix.green = avg;
-            pix.blue = avg;
+// Helper method for taking bands until none are left.
+inline void RowBandScheduler::run_bands(std::unique_lock<std::mutex>* lock) {
+    while (_next_band < _bands) {
+        const size_t band = _next_band++;
+        const size_t row_begin = band * _rows / _bands;
+        const size_t row_end = (band + 1) * _rows / _bands;
+        const Task& task = *_task;
+        lock->unlock();
+        std::exception_ptr error;
+        try {
+            task(row_begin, row_end);
+        } catch (...) {
+            error = std::current_exception();
         }
+        lock->lock();
+        if (error && !_error) _error = error;
+        if (++_finished_bands == _bands) _done.notify_all();
     }
 }
 
-// Sepia colored filter.
-void BitmapParser::sepia() {
-    const double MAX_VAL = 255.0;
-    for (std::vector<Pixel>& row : _pixels) {
-        for (Pixel& pix : row) {
-            // Using Microsoft's ratios.
-            double float_red = 0.393 * pix.red + 0.769 * pix.green
-                + 0.189 * pix.blue;
-            double float_green = 0.349 * pix.red + 0.686 * pix.green
-                + 0.168 * pix.blue;
-            double float_blue = 0.272 * pix.red + 0.534 * pix.green
-                + 0.131 * pix.blue;
-            // If greater than 255, bring it down.
-            if (float_red > MAX_VAL) float_red = MAX_VAL;
-            if (float_green > MAX_VAL) float_green = MAX_VAL;
-            if (float_blue > MAX_VAL) float_blue = MAX_VAL;
-            // Then cast to uint8_t.
-            pix.red = (uint8_t)float_red;
-            pix.green = (uint8_t)float_green;
-            pix.blue = (uint8_t)float_blue;
-        }
+// Worker thread loop, waiting for bands to run.
+inline void RowBandScheduler::work() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait(lock, [this] {
+            return _stopping || _next_band < _bands;
+        });
+        if (_stopping) return;
+        run_bands(&lock);
     }
 }
 
-// Leave color values for red channel only.
-void BitmapParser::isolate_red() {
-    for (std::vector<Pixel>& row : _pixels) {
-        for (Pixel& pix : row) {
-            pix.green = 0;
-            pix.blue = 0;
-        }
+/*
+Runs a kernel over every pixel of a view. Contiguous views
+are done in one call, others one row at a time.
+*/
+template <typename T, typename Kernel>
+inline void for_each_pixel_run(BasicPixelView<T> view, Kernel kernel) {
+    if (view.contiguous()) {
+        kernel(view.data(), view.width() * view.height());
+        return;
     }
+    for (BasicPixelRow<T> row : view) kernel(row.data(), row.size());
 }
 
-// Leave color values for green channel only.
-void BitmapParser::isolate_green() {
-    for (std::vector<Pixel>& row : _pixels) {
-        for (Pixel& pix : row) {
-            pix.red = 0;
-            pix.blue = 0;
-        }
+/*
+Overload: splits the view into row bands, run on threads threads
+of the shared scheduler. Zero uses every hardware thread.
+*/
+template <typename T, typename Kernel>
+inline void for_each_pixel_run(BasicPixelView<T> view, Kernel kernel,
+    size_t threads) {
+    threads = RowBandScheduler::shared_threads(threads);
+    if (threads <= 1) {
+        for_each_pixel_run(view, kernel);
+        return;
     }
+    RowBandScheduler::shared().run(view.height(), threads,
+        [&view, &kernel](size_t row_begin, size_t row_end) {
+            for_each_pixel_run(view.subview(0, row_begin, view.width(),
+                row_end - row_begin), kernel);
+        });
 }
 
-// Leave color values for blue channel only.
-void BitmapParser::isolate_blue() {
-    for (std::vector<Pixel>& row : _pixels) {
-        for (Pixel& pix : row) {
-            pix.red = 0;
-            pix.green = 0;
-        }
+/*
+Table of color filter kernels.
+best() picks the fastest kernels the running CPU supports, once,
+and scalar() always returns the portable kernels.
+*/
+struct ColorKernels {
+    void (*invert)(Pixel* pixels, size_t count);
+    void (*grayscale)(Pixel* pixels, size_t count);
+    void (*sepia)(Pixel* pixels, size_t count);
+    void (*mask)(Pixel* pixels, size_t count, const Pixel& mask);
+
+    static const ColorKernels& scalar();
+    static const ColorKernels& best();
+
+ private:
+    static ColorKernels detect();
+};
+
+// Portable kernels.
+inline const ColorKernels& ColorKernels::scalar() {
+    static const ColorKernels kernels = {invert_pixels_scalar,
+        grayscale_pixels_scalar, sepia_pixels_scalar, mask_pixels_scalar};
+    return kernels;
+}
+
+// Fastest kernels for this CPU, detected on first use.
+inline const ColorKernels& ColorKernels::best() {
+    static const ColorKernels kernels = detect();
+    return kernels;
+}
+
+// Helper method for picking kernels by CPU support.
+inline ColorKernels ColorKernels::detect() {
+    ColorKernels kernels = scalar();
+#ifdef BITMAPPARSER_HAS_X86_SIMD
+    if (cpu_supports_sse2()) {
+        kernels.invert = invert_pixels_sse2;
+        kernels.mask = mask_pixels_sse2;
+    }
+    if (cpu_supports_ssse3()) {
+        kernels.grayscale = grayscale_pixels_ssse3;
+    }
+    if (cpu_supports_avx2()) {
+        kernels.invert = invert_pixels_avx2;
+        kernels.grayscale = grayscale_pixels_avx2;
+        kernels.sepia = sepia_pixels_avx2;
+        kernels.mask = mask_pixels_avx2;
+    }
+#endif
+    return kernels;
+}
+
+/*
+Converts a row of blue, green, red file bytes into pixels of Format.
+Color channels are copied to their offsets, alpha is made opaque, and
+grayscale pixels take the average of the three channels, like
+grayscale_pixels_scalar.
+*/
+template <typename Format>
+inline void bgr_to_format(const uint8_t* src,
+    typename Format::PixelType* dst, size_t width) {
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(dst);
+    if (Format::bytes_per_pixel == 3 && Format::blue == 0 &&
+        Format::green == 1 && Format::red == 2) {
+        // Already in file order.
+        memcpy(bytes, src, width * 3);
+        return;
+    }
+    for (size_t col = 0; col < width; ++col, src += 3) {
+        if (Format::has_color) {
+            bytes[Format::red] = src[2];
+            bytes[Format::green] = src[1];
+            bytes[Format::blue] = src[0];
+        } else {
+            const uint32_t sum = src[0] + src[1] + src[2];
+            bytes[0] = static_cast<uint8_t>((sum * 0xAAABu) >> 17);
+        }
+        if (Format::has_alpha) bytes[3] = 0xff;
+        bytes += Format::bytes_per_pixel;
+    }
+}
+
+/*
+Converts a row of pixels of Format into blue, green, red file bytes.
+Alpha is dropped, and grayscale pixels fill all three channels.
+*/
+template <typename Format>
+inline void format_to_bgr(const typename Format::PixelType* src,
+    uint8_t* dst, size_t width) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(src);
+    if (Format::bytes_per_pixel == 3 && Format::blue == 0 &&
+        Format::green == 1 && Format::red == 2) {
+        memcpy(dst, bytes, width * 3);
+        return;
+    }
+    for (size_t col = 0; col < width; ++col, dst += 3) {
+        dst[0] = bytes[Format::blue];
+        dst[1] = bytes[Format::green];
+        dst[2] = bytes[Format::red];
+        bytes += Format::bytes_per_pixel;
+    }
+}
+
+/*
+Where the channels of a pixel are in a bitmap file: the size of a
+pixel in bytes and the byte offset of each channel. Files without
+an alpha channel have alpha equal to bytes_per_pixel.
+*/
+struct FileLayout {
+    size_t bytes_per_pixel;
+    size_t red;
+    size_t green;
+    size_t blue;
+    size_t alpha;
+};
+
+/*
+Converts a row of file pixels with the given layout into pixels of
+Format. Pixels without alpha are made opaque.
+*/
+template <typename Format>
+inline void file_to_format(const uint8_t* src, const FileLayout& layout,
+    typename Format::PixelType* dst, size_t width) {
+    if (layout.bytes_per_pixel == 3 && layout.blue == 0 &&
+        layout.green == 1 && layout.red == 2) {
+        bgr_to_format<Format>(src, dst, width);
+        return;
+    }
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(dst);
+    const bool has_alpha = layout.alpha < layout.bytes_per_pixel;
+    if (Format::has_alpha && layout.bytes_per_pixel == 4 &&
+        layout.blue == Format::blue && layout.green == Format::green &&
+        layout.red == Format::red && layout.alpha == 3) {
+        // Already in the order of Format.
+        memcpy(bytes, src, width * 4);
+        return;
+    }
+    for (size_t col = 0; col < width; ++col) {
+        if (Format::has_color) {
+            bytes[Format::red] = src[layout.red];
+            bytes[Format::green] = src[layout.green];
+            bytes[Format::blue] = src[layout.blue];
+        } else {
+            const uint32_t sum = src[layout.red] + src[layout.green] +
+                src[layout.blue];
+            bytes[0] = static_cast<uint8_t>((sum * 0xAAABu) >> 17);
+        }
+        if (Format::has_alpha) bytes[3] = has_alpha ? src[layout.alpha] : 0xff;
+        src += layout.bytes_per_pixel;
+        bytes += Format::bytes_per_pixel;
+    }
+}
+
+/*
+Converts a row of palette indices into pixels of Format, using a
+palette that is already converted to Format.
+*/
+template <typename PixelType>
+inline void palette_to_format(const uint8_t* src, const PixelType* palette,
+    PixelType* dst, size_t width) {
+    for (size_t col = 0; col < width; ++col) dst[col] = palette[src[col]];
+}
+
+/*
+Converts a row of pixels of Format into the file layout it is saved
+in: gray palette indices for 8-bit files, blue, green, red for 24-bit
+files, and blue, green, red, alpha for 32-bit files, with opaque alpha
+if Format has none. Only grayscale formats are saved as 8-bit files.
+*/
+template <typename Format>
+inline void format_to_file(const typename Format::PixelType* src,
+    uint8_t* dst, size_t width) {
+    if (Format::file_bits_per_pixel == 24) {
+        format_to_bgr<Format>(src, dst, width);
+        return;
+    }
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(src);
+    if (Format::file_bits_per_pixel == 8) {
+        for (size_t col = 0; col < width; ++col)
+            dst[col] = bytes[col * Format::bytes_per_pixel];
+        return;
+    }
+    if (Format::has_alpha && Format::blue == 0 && Format::green == 1 &&
+        Format::red == 2) {
+        memcpy(dst, bytes, width * 4);
+        return;
+    }
+    for (size_t col = 0; col < width; ++col, dst += 4) {
+        dst[0] = bytes[Format::blue];
+        dst[1] = bytes[Format::green];
+        dst[2] = bytes[Format::red];
+        dst[3] = Format::has_alpha ? bytes[3] : 0xff;
+        bytes += Format::bytes_per_pixel;
+    }
+}
+
+/*
+Color filter kernels for pixels of Format, with the same results as
+the Pixel kernels. The channel offsets are constants, so each format
+gets its own loop at compile time. Alpha is never changed, and the
+grayscale filter has nothing to do on grayscale pixels. Sepia and the
+masks only make sense for formats with color.
+*/
+template <typename Format>
+struct FormatKernels {
+    typedef typename Format::PixelType PixelType;
+
+    static void invert(PixelType* pixels, size_t count) {
+        uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+        if (!Format::has_alpha) {
+            invert_bytes(bytes, count * Format::bytes_per_pixel);
+            return;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            uint8_t* pix = bytes + i * Format::bytes_per_pixel;
+            pix[Format::red] = 0xff - pix[Format::red];
+            pix[Format::green] = 0xff - pix[Format::green];
+            pix[Format::blue] = 0xff - pix[Format::blue];
+        }
+    }
+    static void grayscale(PixelType* pixels, size_t count) {
+        if (!Format::has_color) return;
+        uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+        for (size_t i = 0; i < count; ++i) {
+            uint8_t* pix = bytes + i * Format::bytes_per_pixel;
+            const uint32_t sum = pix[Format::red] + pix[Format::green] +
+                pix[Format::blue];
+            const uint8_t avg = static_cast<uint8_t>((sum * 0xAAABu) >> 17);
+            pix[Format::red] = avg;
+            pix[Format::green] = avg;
+            pix[Format::blue] = avg;
+        }
+    }
+    // Same fixed point method as sepia_pixels_scalar.
+    static void sepia(PixelType* pixels, size_t count) {
+        const uint32_t MAX_VAL = 255;
+        uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+        for (size_t i = 0; i < count; ++i) {
+            uint8_t* pix = bytes + i * Format::bytes_per_pixel;
+            uint8_t* red = pix + Format::red;
+            uint8_t* green = pix + Format::green;
+            uint8_t* blue = pix + Format::blue;
+            const uint32_t new_red = 393 * *red + 769 * *green + 189 * *blue;
+            const uint32_t new_green = 349 * *red + 686 * *green +
+                168 * *blue;
+            const uint32_t new_blue = 272 * *red + 534 * *green +
+                131 * *blue;
+            if (sepia_inexact(new_red) || sepia_inexact(new_green) ||
+                sepia_inexact(new_blue)) {
+                sepia_channels_double(red, green, blue);
+                continue;
+            }
+            *red = static_cast<uint8_t>(std::min(new_red / 1000, MAX_VAL));
+            *green = static_cast<uint8_t>(
+                std::min(new_green / 1000, MAX_VAL));
+            *blue = static_cast<uint8_t>(std::min(new_blue / 1000, MAX_VAL));
+        }
+    }
+    static void mask(PixelType* pixels, size_t count, const Pixel& mask) {
+        uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+        for (size_t i = 0; i < count; ++i) {
+            uint8_t* pix = bytes + i * Format::bytes_per_pixel;
+            pix[Format::red] &= mask.red;
+            pix[Format::green] &= mask.green;
+            pix[Format::blue] &= mask.blue;
+        }
+    }
+
+ private:
+    // Inverts size bytes, going through the Pixel kernel where it can.
+    static void invert_bytes(uint8_t* bytes, size_t size) {
+        const size_t whole = size / 3;
+        ColorKernels::best().invert(reinterpret_cast<Pixel*>(bytes), whole);
+        for (size_t i = whole * 3; i < size; ++i) bytes[i] = 0xff - bytes[i];
+    }
+};
+
+// Pixels get the runtime-dispatched kernels of ColorKernels.
+template <>
+struct FormatKernels<Rgb24Format> {
+    static void invert(Pixel* pixels, size_t count) {
+        ColorKernels::best().invert(pixels, count);
+    }
+    static void grayscale(Pixel* pixels, size_t count) {
+        ColorKernels::best().grayscale(pixels, count);
+    }
+    static void sepia(Pixel* pixels, size_t count) {
+        ColorKernels::best().sepia(pixels, count);
+    }
+    static void mask(Pixel* pixels, size_t count, const Pixel& mask) {
+        ColorKernels::best().mask(pixels, count, mask);
+    }
+};
+
+#ifdef BITMAPPARSER_HAS_PREAD
+/*
+Reads count bytes at offset with pread, retrying short reads.
+Returns the number of bytes read, which is less than count
+only at the end of the file.
+*/
+inline size_t read_at(int fd, uint8_t* buffer, size_t count,
+    size_t offset) {
+    size_t done = 0;
+    while (done < count) {
+        const ssize_t result = pread(fd, buffer + done, count - done,
+            static_cast<off_t>(offset + done));
+        if (result < 0) throw IOException();
+        if (result == 0) break;
+        done += static_cast<size_t>(result);
+    }
+    return done;
+}
+
+// Writes count bytes at offset with pwrite, retrying short writes.
+inline void write_at(int fd, const uint8_t* buffer, size_t count,
+    size_t offset) {
+    size_t done = 0;
+    while (done < count) {
+        const ssize_t result = pwrite(fd, buffer + done, count - done,
+            static_cast<off_t>(offset + done));
+        if (result <= 0) throw IOException();
+        done += static_cast<size_t>(result);
+    }
+}
+#endif  // BITMAPPARSER_HAS_PREAD
+
+/*
+Optional per-operation statistics. Define BITMAPPARSER_INSTRUMENTATION
+before including the header to report every public operation to a
+sink; otherwise the measurements compile to nothing.
+*/
+#ifdef BITMAPPARSER_INSTRUMENTATION
+// Statistics for one call of an operation.
+struct OperationStats {
+    // Name of the operation, such as "import" or "sepia".
+    const char* operation;
+    // Wall time of the call.
+    double seconds;
+    // File bytes read and written.
+    size_t bytes_read;
+    size_t bytes_written;
+    // Pixels read or written.
+    size_t pixels;
+    // Times the image's pixel or file buffer was reallocated.
+    size_t allocations;
+};
+
+typedef std::function<void(const OperationStats&)> StatsSink;
+
+// The function that receives the statistics. Empty by default.
+inline StatsSink& stats_sink() {
+    static StatsSink sink;
+    return sink;
+}
+
+/*
+Sets the sink, before any operation is started. It is called on the
+thread that ran the operation, so it must be thread-safe if images
+are processed concurrently, as in BatchProcessor.
+*/
+inline void set_stats_sink(StatsSink sink) {
+    stats_sink() = std::move(sink);
+}
+
+/*
+Times one operation and reports it when it goes out of scope, even
+if the operation throws. Reallocations are counted by watching the
+data pointers of the buffers passed in, if any.
+*/
+class OperationTimer {
+ public:
+    explicit OperationTimer(const char* operation)
+        : _start(std::chrono::steady_clock::now()),
+        _pixels(nullptr), _pixels_data_of(nullptr), _pixels_data(nullptr),
+        _staging(nullptr), _staging_data_of(nullptr),
+        _staging_data(nullptr) {
+        start(operation);
+    }
+    template <typename Buffer, typename Staging>
+    OperationTimer(const char* operation, const Buffer* pixels,
+        const Staging* staging)
+        : _start(std::chrono::steady_clock::now()),
+        _pixels(pixels), _pixels_data_of(&data_of<Buffer>),
+        _pixels_data(pixels->data()),
+        _staging(staging), _staging_data_of(&data_of<Staging>),
+        _staging_data(staging->data()) {
+        start(operation);
+    }
+    ~OperationTimer() {
+        const StatsSink& sink = stats_sink();
+        if (!sink) return;
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - _start;
+        _stats.seconds = elapsed.count();
+        if (_pixels && _pixels_data_of(_pixels) != _pixels_data)
+            ++_stats.allocations;
+        if (_staging && _staging_data_of(_staging) != _staging_data)
+            ++_stats.allocations;
+        sink(_stats);
+    }
+    OperationStats& stats() { return _stats; }
+
+ private:
+    OperationTimer(const OperationTimer&) = delete;
+    OperationTimer& operator=(const OperationTimer&) = delete;
+
+    // Helper method for clearing the statistics.
+    void start(const char* operation) {
+        _stats.operation = operation;
+        _stats.seconds = 0.0;
+        _stats.bytes_read = 0;
+        _stats.bytes_written = 0;
+        _stats.pixels = 0;
+        _stats.allocations = 0;
+    }
+    // Data of a pixel buffer or staging vector of any type.
+    template <typename Container>
+    static const void* data_of(const void* container) {
+        return static_cast<const Container*>(container)->data();
+    }
+
+    OperationStats _stats;
+    std::chrono::steady_clock::time_point _start;
+    const void* _pixels;
+    const void* (*_pixels_data_of)(const void* container);
+    const void* _pixels_data;
+    const void* _staging;
+    const void* (*_staging_data_of)(const void* container);
+    const void* _staging_data;
+};
+
+// Starts timing the enclosing function.
+#define BITMAPPARSER_MEASURE(operation) \
+    OperationTimer bitmapparser_timer(operation)
+// Same, also counting reallocations of this image's buffers.
+#define BITMAPPARSER_MEASURE_IMAGE(operation) \
+    OperationTimer bitmapparser_timer(operation, &_pixels, &_staging)
+// Sets a field of the statistics being measured.
+#define BITMAPPARSER_RECORD(field, value) \
+    (bitmapparser_timer.stats().field = (value))
+#else
+#define BITMAPPARSER_MEASURE(operation)
+#define BITMAPPARSER_MEASURE_IMAGE(operation)
+#define BITMAPPARSER_RECORD(field, value)
+#endif  // BITMAPPARSER_INSTRUMENTATION
+
+/*
+Allocator allocates the pixels and the staging buffer, on the thread
+that calls into the image; the bands of the threaded import and save
+use their own buffers.
+*/
+template <typename Format,
+    typename Allocator = std::allocator<typename Format::PixelType> >
+class BasicBitmapParser {
+ public:
+    // Pixel type and containers for this format.
+    typedef typename Format::PixelType PixelType;
+    typedef Allocator allocator_type;
+    typedef BasicPixelBuffer<PixelType, Allocator> Buffer;
+    typedef typename Buffer::Storage Storage;
+    typedef BasicPixelRow<PixelType> Row;
+    typedef BasicPixelRow<const PixelType> ConstRow;
+    typedef BasicPixelView<PixelType> View;
+    typedef BasicPixelView<const PixelType> ConstView;
+
+ private:
+    // Constants for correct images.
+    static const size_t CORRECT_SIG = 0x424d;
+    static const size_t CORRECT_HEADER_SIZE = 0xe;
+    static const size_t CORRECT_TOTAL_HEADER_SIZE = 0x36;
+    static const size_t CORRECT_INFOHEADER_SIZE = 0x28;
+    static const size_t CORRECT_BITS_PER_PIXEL = 0x18;
+    static const size_t CORRECT_BYTES_PER_PIXEL = 3;
+    static const size_t CORRECT_PLANES = 1;
+    static const size_t CORRECT_COMPRESSION = 0;
+    static const size_t CORRECT_COLORS_USED = 0;
+    static const size_t CORRECT_IMPORTANT_COLORS = 0;
+    // Constants for 32-bit images and larger info headers.
+    static const size_t ALPHA_BITS_PER_PIXEL = 0x20;
+    static const size_t BITFIELDS_COMPRESSION = 3;
+    static const size_t V4_INFOHEADER_SIZE = 0x6c;
+    static const size_t V5_INFOHEADER_SIZE = 0x7c;
+    // Size of the masks after a 40-byte info header.
+    static const size_t MASKS_SIZE = 0xc;
+    // "sRGB", the color space written in V4 info headers.
+    static const uint32_t SRGB_COLOR_SPACE = 0x73524742;
+    // Constants for 8-bit images, whose palette follows the info header.
+    static const size_t PALETTE_BITS_PER_PIXEL = 0x8;
+    static const size_t PALETTE_COLORS = 0x100;
+    static const size_t PALETTE_SIZE = 0x400;
+    // Largest headers and palette written before the pixels.
+    static const size_t MAX_HEADERS_SIZE =
+        CORRECT_HEADER_SIZE + V5_INFOHEADER_SIZE + PALETTE_SIZE;
+    // Layout of the files this format is saved as.
+    static const size_t FILE_BYTES_PER_PIXEL = Format::file_bits_per_pixel / 8;
+    static const size_t FILE_HEADERS_SIZE =
+        CORRECT_HEADER_SIZE + Format::file_infoheader_size +
+        (Format::file_bits_per_pixel == PALETTE_BITS_PER_PIXEL ?
+        PALETTE_SIZE : 0);
+
+    // Constants for word/dword size in bytes.
+    static const size_t BYTE = 1;
+    static const size_t WORD = 2;
+    static const size_t DWORD = 4;
+
+    /*
+    Containers per section of the bitmap file:
+    File pointer, header, infoheader, and pixel buffer.
+    */
+    FILE* _fileptr;
+    Header _header;
+    InfoHeader _infoheader;
+    Buffer _pixels;
+    size_t _padding;
+    // Number of threads for color filters.
+    size_t _threads;
+    // Staging buffer for file I/O, kept between imports and saves.
+    typedef typename std::allocator_traits<Allocator>::template
+        rebind_alloc<uint8_t> ByteAllocator;
+    std::vector<uint8_t, ByteAllocator> _staging;
+
+    /* PRIVATE FUNCTION HEADERS */
+    // Wrapper for fread with error handling.
+    void check_read(void* buffer, size_t size, size_t count, FILE* stream);
+    // Wrapper for fwrite with error handling.
+    void check_write(void* buffer, size_t size, size_t count, FILE* stream);
+    // Input and output for the header and info header structs.
+    void import_headers();
+    void write_headers(const Header& header, const InfoHeader& infoheader);
+    // Helper for import, reading the headers and pixels of _fileptr.
+    void import_pixels();
+    // Input of the palette of 8-bit images.
+    void import_palette(Storage* palette);
+    // Little endian decoding of raw header bytes.
+    static uint16_t decode_word(const uint8_t* buffer);
+    static uint32_t decode_dword(const uint8_t* buffer);
+    static void decode_header(const uint8_t* buffer, Header* header);
+    static void decode_infoheader(const uint8_t* buffer,
+        InfoHeader* infoheader);
+    // Little endian encoding of header bytes.
+    static void encode_word(uint16_t value, uint8_t* buffer);
+    static void encode_dword(uint32_t value, uint8_t* buffer);
+    static void encode_header(const Header& header, uint8_t* buffer);
+    static void encode_infoheader(const InfoHeader& infoheader,
+        uint8_t* buffer);
+    // Channel masks, and the rest of V4 and V5 info headers.
+    static bool has_masks(const InfoHeader& infoheader);
+    static void decode_masks(const uint8_t* buffer, bool alpha,
+        InfoHeader* infoheader);
+    static void encode_extension(const InfoHeader& infoheader,
+        uint8_t* buffer);
+    // Decodes both headers and any masks, if length bytes are enough.
+    static bool decode_headers(const uint8_t* buffer, size_t length,
+        Header* header, InfoHeader* infoheader);
+    // Encodes both headers and any palette, returning the number of bytes.
+    static size_t encode_headers(const Header& header,
+        const InfoHeader& infoheader, uint8_t* buffer);
+    // Palettes of 8-bit images.
+    static size_t palette_colors(const InfoHeader& infoheader);
+    static void decode_palette(const uint8_t* buffer, size_t colors,
+        Storage* palette);
+    static void encode_palette(uint8_t* buffer);
+    // Writes pixels bottom-up after the headers.
+    void write_pixels(ConstView view, size_t padding);
+    // Sanity checks on the bounds of a region.
+    void check_region(size_t x_begin, size_t y_begin,
+        size_t x_end, size_t y_end) const;
+    // Transposes the image, optionally flipping it for a rotation.
+    void transpose(bool reverse_rows, bool reverse_cols);
+    // Check on image compatibility and correctness.
+    static bool compatible(const Header& header,
+        const InfoHeader& infoheader);
+    bool compatible() const;
+    // Checks for import, and the layout of the pixels it reads.
+    static bool readable(const Header& header, const InfoHeader& infoheader);
+    static bool file_layout(const InfoHeader& infoheader, FileLayout* layout);
+    static bool mask_offset(uint32_t mask, size_t* offset);
+    // Changes the headers to the layout this format is saved in.
+    void convert_headers();
+    // Changes the dimensions in the headers to those of the pixels.
+    void resize_headers();
+
+    // Swaps in the pixels it builds.
+    friend class BitmapPipeline;
+    // Readers and writers that handle headers without a BitmapParser.
+    friend class BitmapReader;
+    friend class BitmapWriter;
+    friend class MappedBitmap;
+
+ public:
+    /* PUBLIC FUNCTION HEADERS */
+    // Constructors.
+    BasicBitmapParser();
+    explicit BasicBitmapParser(const Allocator& alloc);
+    explicit BasicBitmapParser(const char* filename,
+        const Allocator& alloc = Allocator());
+    explicit BasicBitmapParser(const std::string& filename,
+        const Allocator& alloc = Allocator());
+    /*
+    Copies duplicate the pixels, moves hand them over. The move ctor
+    is noexcept, so containers of images move them when they grow.
+    Like std::vector, move assignment may have to copy the pixels when
+    the allocators do not compare equal, and is only noexcept when the
+    allocator rules that out.
+    */
+    BasicBitmapParser(const BasicBitmapParser& other) = default;
+    BasicBitmapParser& operator=(const BasicBitmapParser& other) = default;
+    BasicBitmapParser(BasicBitmapParser&& other) noexcept(
+        std::is_nothrow_move_constructible<Storage>::value);
+    BasicBitmapParser& operator=(BasicBitmapParser&& other) noexcept(
+        std::is_nothrow_move_assignable<Storage>::value);
+    // Header accessors and mutators.
+    const Header& read_header() const;
+    Header& header();
+    void replace_header(const Header& new_header);
+    // Info header accessors and mutators.
+    const InfoHeader& read_infoheader() const;
+    InfoHeader& infoheader();
+    void replace_infoheader(const InfoHeader& new_infoheader);
+    // Pixel accessors and mutators.
+    ConstView read_pixels() const;
+    View pixels();
+    void replace_pixels(
+        const std::vector<std::vector<PixelType> >& new_pixels);
+    void replace_pixels(const Buffer& new_pixels);
+    void replace_pixels(Buffer&& new_pixels);
+    // Moving pixels out of and into this instance without copying.
+    Buffer take_pixels();
+    void adopt_pixels(Storage&& new_pixels, size_t width, size_t height);
+    // The allocator of the pixels.
+    Allocator get_allocator() const;
+    // Padding accessors and mutators.
+    const size_t read_padding() const;
+    size_t padding();
+    void replace_padding(size_t new_padding);
+    // Thread count accessors and mutators.
+    size_t read_threads() const;
+    void replace_threads(size_t new_threads);
+    // Calculator for row padding.
+    static size_t row_padding(size_t width);
+    size_t row_padding() const;
+    // Calculator for file size.
+    static size_t calculate_size(size_t width, size_t height);
+    size_t calculate_size() const;
+    // Reads only the headers of a bitmap file, never throwing.
+    static BitmapInfo probe(const char* filename);
+    static BitmapInfo probe(const std::string& filename);
+    // Read from a bitmap file.
+    void import(const char* filename);
+    void import(const char* filename, size_t threads);
+    // Write to a bitmap file.
+    void save(const char* filename);
+    void save(const char* filename, size_t threads);
+    void save(const char* filename, ConstView view);
+    // Erase all data.
+    void clear_data();
+    // Print information about the image.
+    void print_metadata(bool hex) const;
+    void print_pixels(bool hex) const;
+    // Image reflections.
+    void flip_horizontal();
+    void flip_vertical();
+    // Image transposition and rotations.
+    void transpose();
+    void rotate90_left();
+    void rotate90_right();
+    // Image cropping.
+    void crop(size_t x_begin, size_t y_begin, size_t x_end, size_t y_end);
+    // Views of part of the image, without copying.
+    View region(size_t x_begin, size_t y_begin,
+        size_t x_end, size_t y_end);
+    ConstView read_region(size_t x_begin, size_t y_begin,
+        size_t x_end, size_t y_end) const;
+    // Another image on top of this image.
+    void superimpose(const BasicBitmapParser& other,
+        size_t x_begin, size_t y_begin);
+    void superimpose(ConstView other, size_t x_begin, size_t y_begin);
+    // Color filters.
+    void invert_colors();
+    void grayscale();
+    void sepia();
+    void isolate_red();
+    void isolate_green();
+    void isolate_blue();
+    /*
+    Color filters on a view, such as a region of an image,
+    on up to threads threads. Zero uses every hardware thread.
+    */
+    static void invert_colors(View view, size_t threads = 1);
+    static void grayscale(View view, size_t threads = 1);
+    static void sepia(View view, size_t threads = 1);
+    static void isolate_red(View view, size_t threads = 1);
+    static void isolate_green(View view, size_t threads = 1);
+    static void isolate_blue(View view, size_t threads = 1);
+};
+
+// Parser for 24-bit images, holding RGB pixels.
+typedef BasicBitmapParser<Rgb24Format> BitmapParser;
+
+/*
+Images whose pixels and staging buffer come from a BufferPool, so a
+stream of images of the same size reuses the same memory.
+*/
+template <typename Format>
+using PooledBasicBitmapParser =
+    BasicBitmapParser<Format, PoolAllocator<typename Format::PixelType> >;
+typedef PooledBasicBitmapParser<Rgb24Format> PooledBitmapParser;
+
+#ifdef BITMAPPARSER_HAS_PMR
+/*
+Images and buffers whose pixels come from a std::pmr::memory_resource,
+such as an arena per request, passed to the constructor.
+*/
+template <typename Format>
+using PmrBasicBitmapParser = BasicBitmapParser<Format,
+    std::pmr::polymorphic_allocator<typename Format::PixelType> >;
+typedef PmrBasicBitmapParser<Rgb24Format> PmrBitmapParser;
+typedef BasicPixelBuffer<Pixel, std::pmr::polymorphic_allocator<Pixel> >
+    PmrPixelBuffer;
+#endif  // BITMAPPARSER_HAS_PMR
+
+/*
+Wrapper for reading and checking fread.
+No need to check return value of fread, since feof/ferror
+flags are set automatically.
+*/
+template <typename Format, typename Allocator>
+inline void BasicBitmapParser<Format, Allocator>::check_read(void* buffer,
+    size_t size, size_t count, FILE* stream) {
+    fread(buffer, size, count, stream);
+    if (feof(stream)) throw EOFException();
+    else if (ferror(stream)) throw IOException();
+}
+
+/*
+Wrapper for writing and checking fwrite.
+No need to check return value of fwrite, since the ferror
+flag is set automatically.
+*/
+template <typename Format, typename Allocator>
+inline void BasicBitmapParser<Format, Allocator>::check_write(void* buffer,
+    size_t size, size_t count, FILE* stream) {
+    fwrite(buffer, size, count, stream);
+    if (ferror(stream)) throw IOException();
+}
+
+/*
+Helper method for importing the header and info header. The first
+54 bytes are read in one call and decoded from the buffer, followed
+by the channel masks if the info header has them. The masks follow
+the first 40 bytes of the info header, with alpha only in V4 and V5.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::import_headers() {
+    uint8_t buffer[CORRECT_TOTAL_HEADER_SIZE + MASKS_SIZE + DWORD];
+    check_read(buffer, sizeof(char), CORRECT_TOTAL_HEADER_SIZE, _fileptr);
+    decode_header(buffer, &_header);
+    decode_infoheader(buffer + CORRECT_HEADER_SIZE, &_infoheader);
+    if (has_masks(_infoheader)) {
+        const bool alpha = _infoheader.size >= V4_INFOHEADER_SIZE;
+        uint8_t* masks = buffer + CORRECT_TOTAL_HEADER_SIZE;
+        check_read(masks, sizeof(char),
+            alpha ? MASKS_SIZE + DWORD : MASKS_SIZE, _fileptr);
+        decode_masks(masks, alpha, &_infoheader);
+    }
+}
+
+/*
+Helper method for writing the header and info header, and the
+palette of 8-bit images, encoded into one buffer and written in
+one call.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::write_headers(const Header& header,
+    const InfoHeader& infoheader) {
+    uint8_t buffer[MAX_HEADERS_SIZE];
+    check_write(buffer, sizeof(char),
+        encode_headers(header, infoheader, buffer), _fileptr);
+}
+
+/*
+Helper method for importing the palette of an 8-bit image, which
+follows the info header, converted to pixels of this format.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::import_palette(
+    Storage* palette) {
+    const size_t colors = palette_colors(_infoheader);
+    if (static_cast<long>(CORRECT_HEADER_SIZE + _infoheader.size) !=
+        ftell(_fileptr))
+        fseek(_fileptr, CORRECT_HEADER_SIZE + _infoheader.size, SEEK_SET);
+    uint8_t buffer[PALETTE_SIZE];
+    check_read(buffer, sizeof(char), colors * DWORD, _fileptr);
+    decode_palette(buffer, colors, palette);
+}
+
+// Decodes a little endian word from raw bytes.
+template <typename Format, typename Allocator>
+uint16_t BasicBitmapParser<Format, Allocator>::decode_word(
+    const uint8_t* buffer) {
+    return static_cast<uint16_t>(buffer[0]) |
+        (static_cast<uint16_t>(buffer[1]) << 8);
+}
+
+// Decodes a little endian dword from raw bytes.
+template <typename Format, typename Allocator>
+uint32_t BasicBitmapParser<Format, Allocator>::decode_dword(
+    const uint8_t* buffer) {
+    return static_cast<uint32_t>(buffer[0]) |
+        (static_cast<uint32_t>(buffer[1]) << 8) |
+        (static_cast<uint32_t>(buffer[2]) << 16) |
+        (static_cast<uint32_t>(buffer[3]) << 24);
+}
+
+/*
+Decodes the 14-byte header from raw file bytes.
+The signature is the only field that is not little endian,
+so it reads 42 4D not 4D 42.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::decode_header(const uint8_t* buffer,
+    Header* header) {
+    header->signature = static_cast<uint16_t>(buffer[1]) |
+        (static_cast<uint16_t>(buffer[0]) << 8);
+    header->file_size = decode_dword(buffer + 2);
+    header->reserved = decode_dword(buffer + 6);
+    header->data_offset = decode_dword(buffer + 10);
+}
+
+// Decodes the 40-byte info header from raw file bytes.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::decode_infoheader(
+    const uint8_t* buffer, InfoHeader* infoheader) {
+    // Only planes and bits per pixel are words.
+    infoheader->size = decode_dword(buffer);
+    infoheader->width = decode_dword(buffer + 4);
+    infoheader->height = decode_dword(buffer + 8);
+    infoheader->planes = decode_word(buffer + 12);
+    infoheader->bits_per_pixel = decode_word(buffer + 14);
+    infoheader->compression = decode_dword(buffer + 16);
+    infoheader->image_size = decode_dword(buffer + 20);
+    infoheader->x_pixels_per_meter = decode_dword(buffer + 24);
+    infoheader->y_pixels_per_meter = decode_dword(buffer + 28);
+    infoheader->colors_used = decode_dword(buffer + 32);
+    infoheader->important_colors = decode_dword(buffer + 36);
+    // The masks come after these 40 bytes, see decode_masks.
+    infoheader->red_mask = infoheader->green_mask = 0;
+    infoheader->blue_mask = infoheader->alpha_mask = 0;
+}
+
+// Encodes a word as little endian bytes.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::encode_word(uint16_t value,
+    uint8_t* buffer) {
+    buffer[0] = static_cast<uint8_t>(value);
+    buffer[1] = static_cast<uint8_t>(value >> 8);
+}
+
+// Encodes a dword as little endian bytes.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::encode_dword(uint32_t value,
+    uint8_t* buffer) {
+    buffer[0] = static_cast<uint8_t>(value);
+    buffer[1] = static_cast<uint8_t>(value >> 8);
+    buffer[2] = static_cast<uint8_t>(value >> 16);
+    buffer[3] = static_cast<uint8_t>(value >> 24);
+}
+
+// Encodes the 14-byte header as raw file bytes, always signed "BM".
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::encode_header(const Header& header,
+    uint8_t* buffer) {
+    buffer[0] = 'B';
+    buffer[1] = 'M';
+    encode_dword(header.file_size, buffer + 2);
+    encode_dword(header.reserved, buffer + 6);
+    encode_dword(header.data_offset, buffer + 10);
+}
+
+// Encodes the 40-byte info header as raw file bytes.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::encode_infoheader(
+    const InfoHeader& infoheader, uint8_t* buffer) {
+    // Only planes and bits per pixel are words.
+    encode_dword(infoheader.size, buffer);
+    encode_dword(infoheader.width, buffer + 4);
+    encode_dword(infoheader.height, buffer + 8);
+    encode_word(infoheader.planes, buffer + 12);
+    encode_word(infoheader.bits_per_pixel, buffer + 14);
+    encode_dword(infoheader.compression, buffer + 16);
+    encode_dword(infoheader.image_size, buffer + 20);
+    encode_dword(infoheader.x_pixels_per_meter, buffer + 24);
+    encode_dword(infoheader.y_pixels_per_meter, buffer + 28);
+    encode_dword(infoheader.colors_used, buffer + 32);
+    encode_dword(infoheader.important_colors, buffer + 36);
+}
+
+// True if the channel masks follow the first 40 bytes of the info header.
+template <typename Format, typename Allocator>
+bool BasicBitmapParser<Format, Allocator>::has_masks(
+    const InfoHeader& infoheader) {
+    return infoheader.size == V4_INFOHEADER_SIZE ||
+        infoheader.size == V5_INFOHEADER_SIZE ||
+        (infoheader.size == CORRECT_INFOHEADER_SIZE &&
+        infoheader.compression == BITFIELDS_COMPRESSION);
+}
+
+// Decodes the red, green, blue and optionally alpha masks.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::decode_masks(const uint8_t* buffer,
+    bool alpha, InfoHeader* infoheader) {
+    infoheader->red_mask = decode_dword(buffer);
+    infoheader->green_mask = decode_dword(buffer + 4);
+    infoheader->blue_mask = decode_dword(buffer + 8);
+    infoheader->alpha_mask = alpha ? decode_dword(buffer + 12) : 0;
+}
+
+/*
+Encodes the part of a V4 or V5 info header after the first 40 bytes:
+the masks, the sRGB color space, and zeros for the color endpoints,
+gamma, and the V5 fields.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::encode_extension(
+    const InfoHeader& infoheader, uint8_t* buffer) {
+    memset(buffer, 0, infoheader.size - CORRECT_INFOHEADER_SIZE);
+    encode_dword(infoheader.red_mask, buffer);
+    encode_dword(infoheader.green_mask, buffer + 4);
+    encode_dword(infoheader.blue_mask, buffer + 8);
+    encode_dword(infoheader.alpha_mask, buffer + 12);
+    encode_dword(SRGB_COLOR_SPACE, buffer + 16);
+}
+
+/*
+Decodes the header, info header and any masks from the first length
+bytes of a file. Returns false if they are cut short.
+*/
+template <typename Format, typename Allocator>
+bool BasicBitmapParser<Format, Allocator>::decode_headers(const uint8_t* buffer,
+    size_t length, Header* header, InfoHeader* infoheader) {
+    if (length < CORRECT_TOTAL_HEADER_SIZE) return false;
+    decode_header(buffer, header);
+    decode_infoheader(buffer + CORRECT_HEADER_SIZE, infoheader);
+    if (!has_masks(*infoheader)) return true;
+    const bool alpha = infoheader->size >= V4_INFOHEADER_SIZE;
+    if (length < CORRECT_TOTAL_HEADER_SIZE + MASKS_SIZE +
+        (alpha ? DWORD : 0)) return false;
+    decode_masks(buffer + CORRECT_TOTAL_HEADER_SIZE, alpha, infoheader);
+    return true;
+}
+
+/*
+Encodes the header and info header, including the rest of a V4 or V5
+info header, and the gray palette of 8-bit images.
+buffer must hold MAX_HEADERS_SIZE bytes.
+*/
+template <typename Format, typename Allocator>
+size_t BasicBitmapParser<Format, Allocator>::encode_headers(
+    const Header& header, const InfoHeader& infoheader, uint8_t* buffer) {
+    encode_header(header, buffer);
+    encode_infoheader(infoheader, buffer + CORRECT_HEADER_SIZE);
+    size_t size = CORRECT_TOTAL_HEADER_SIZE;
+    if (infoheader.size == V4_INFOHEADER_SIZE ||
+        infoheader.size == V5_INFOHEADER_SIZE) {
+        encode_extension(infoheader, buffer + CORRECT_TOTAL_HEADER_SIZE);
+        size = CORRECT_HEADER_SIZE + infoheader.size;
+    }
+    if (infoheader.bits_per_pixel == PALETTE_BITS_PER_PIXEL) {
+        encode_palette(buffer + size);
+        size += PALETTE_SIZE;
+    }
+    return size;
+}
+
+// Number of colors in the palette of an 8-bit image, 0 meaning all 256.
+template <typename Format, typename Allocator>
+size_t BasicBitmapParser<Format, Allocator>::palette_colors(
+    const InfoHeader& infoheader) {
+    return infoheader.colors_used == 0 ? PALETTE_COLORS :
+        infoheader.colors_used;
+}
+
+/*
+Converts the first colors entries of a palette (blue, green, red and
+an unused byte each) to pixels of this format. Indices past the
+end of the palette are black.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::decode_palette(const uint8_t* buffer,
+    size_t colors, Storage* palette) {
+    const FileLayout bgrx = {4, 2, 1, 0, 4};
+    const uint8_t black[4] = {0, 0, 0, 0};
+    palette->resize(PALETTE_COLORS);
+    file_to_format<Format>(buffer, bgrx, palette->data(), colors);
+    for (size_t index = colors; index < PALETTE_COLORS; ++index)
+        file_to_format<Format>(black, bgrx, palette->data() + index, 1);
+}
+
+// Encodes a palette of 256 grays, from black to white.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::encode_palette(uint8_t* buffer) {
+    for (size_t index = 0; index < PALETTE_COLORS; ++index) {
+        buffer[0] = buffer[1] = buffer[2] = static_cast<uint8_t>(index);
+        buffer[3] = 0;
+        buffer += DWORD;
+    }
+}
+
+/*
+Helper method for checking file correctness and compatibility.
+Returns true if correct and compatible, false otherwise.
+Not checking image size with relation to width, height, and padding
+since some images have zero bytes appended to them,
+especially ones converted and edited through Photoshop.
+(Adobe appends two 0x00 bytes.)
+*/
+template <typename Format, typename Allocator>
+bool BasicBitmapParser<Format, Allocator>::compatible(const Header& header,
+    const InfoHeader& infoheader) {
+    // Check image signature for "BM".
+    if (header.signature != CORRECT_SIG) return false;
+    // Check for data offset - no palette.
+    else if (header.data_offset !=
+        CORRECT_TOTAL_HEADER_SIZE) return false;
+    // Check for info header size.
+    else if (infoheader.size != CORRECT_INFOHEADER_SIZE) return false;
+    // Check for # of image planes.
+    else if (infoheader.planes != CORRECT_PLANES) return false;
+    // Check for compression.
+    else if (infoheader.compression != CORRECT_COMPRESSION) return false;
+    // Check for 24 bits per pixel.
+    else if (infoheader.bits_per_pixel !=
+        CORRECT_BITS_PER_PIXEL) return false;
+    // Check number of colors in palette.
+    else if (infoheader.colors_used != CORRECT_COLORS_USED) return false;
+    // Check number of important colors.
+    else if (infoheader.important_colors !=
+        CORRECT_IMPORTANT_COLORS) return false;
+    // All checks passed.
+    else
+        return true;
+}
+
+// Overload: if no parameters are passed, checks this instance.
+template <typename Format, typename Allocator>
+bool BasicBitmapParser<Format, Allocator>::compatible() const {
+    return compatible(_header, _infoheader);
+}
+
+/*
+Helper method for checking whether import can read a file. Unlike
+compatible, 32-bit pixels, channel masks, V4 and V5 info headers,
+and pixels that start further into the file are allowed. The masks
+must already be decoded.
+*/
+template <typename Format, typename Allocator>
+bool BasicBitmapParser<Format, Allocator>::readable(const Header& header,
+    const InfoHeader& infoheader) {
+    FileLayout layout;
+    const bool palette =
+        infoheader.bits_per_pixel == PALETTE_BITS_PER_PIXEL;
+    // Check image signature for "BM".
+    if (header.signature != CORRECT_SIG) return false;
+    // Check for a 40-byte, V4 or V5 info header.
+    else if (infoheader.size != CORRECT_INFOHEADER_SIZE &&
+        infoheader.size != V4_INFOHEADER_SIZE &&
+        infoheader.size != V5_INFOHEADER_SIZE) return false;
+    // Check for # of image planes.
+    else if (infoheader.planes != CORRECT_PLANES) return false;
+    /*
+    Check for a bottom-up image. Top-down images store a negative
+    height, which has the sign bit set, and are not supported.
+    */
+    else if (infoheader.height & 0x80000000) return false;
+    // Check bits per pixel, compression and masks.
+    else if (!file_layout(infoheader, &layout)) return false;
+    // Check number of colors in palette, which only 8-bit images have.
+    else if (palette ? infoheader.colors_used > PALETTE_COLORS :
+        infoheader.colors_used != CORRECT_COLORS_USED) return false;
+    // Check number of important colors.
+    else if (palette ? infoheader.important_colors > PALETTE_COLORS :
+        infoheader.important_colors != CORRECT_IMPORTANT_COLORS)
+        return false;
+    // Check that the pixels come after the headers, masks and palette.
+    else if (header.data_offset < CORRECT_HEADER_SIZE + infoheader.size +
+        (infoheader.size == CORRECT_INFOHEADER_SIZE &&
+        has_masks(infoheader) ? MASKS_SIZE : 0) +
+        (palette ? palette_colors(infoheader) * DWORD : 0)) return false;
+    // All checks passed.
+    else
+        return true;
+}
+
+/*
+Helper method for finding where the channels of a file's pixels are.
+8-bit files are one palette index per pixel, without compression.
+24-bit files are blue, green, red. 32-bit files are blue, green, red
+and an unused byte without compression, or wherever the masks put
+the channels with bitfield compression, as long as every mask covers
+one whole byte. Returns false for anything else.
+*/
+template <typename Format, typename Allocator>
+bool BasicBitmapParser<Format, Allocator>::file_layout(
+    const InfoHeader& infoheader, FileLayout* layout) {
+    const FileLayout index = {1, 0, 0, 0, 1};
+    const FileLayout bgr = {3, 2, 1, 0, 3};
+    const FileLayout bgrx = {4, 2, 1, 0, 4};
+    if (infoheader.bits_per_pixel == PALETTE_BITS_PER_PIXEL &&
+        infoheader.compression == CORRECT_COMPRESSION) {
+        *layout = index;
+        return true;
+    } else if (infoheader.bits_per_pixel == CORRECT_BITS_PER_PIXEL &&
+        infoheader.compression == CORRECT_COMPRESSION) {
+        *layout = bgr;
+        return true;
+    } else if (infoheader.bits_per_pixel != ALPHA_BITS_PER_PIXEL) {
+        return false;
+    } else if (infoheader.compression == CORRECT_COMPRESSION) {
+        *layout = bgrx;
+        return true;
+    } else if (infoheader.compression != BITFIELDS_COMPRESSION) {
+        return false;
+    }
+    *layout = bgrx;
+    return mask_offset(infoheader.red_mask, &layout->red) &&
+        mask_offset(infoheader.green_mask, &layout->green) &&
+        mask_offset(infoheader.blue_mask, &layout->blue) &&
+        (infoheader.alpha_mask == 0 ||
+        mask_offset(infoheader.alpha_mask, &layout->alpha));
+}
+
+// Helper method for the offset of the byte a mask covers, if it covers one.
+template <typename Format, typename Allocator>
+bool BasicBitmapParser<Format, Allocator>::mask_offset(uint32_t mask,
+    size_t* offset) {
+    for (size_t byte = 0; byte < DWORD; ++byte) {
+        if (mask == (0xffu << (8 * byte))) {
+            *offset = byte;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+Helper method for import. If the file had another layout than the one
+this format is saved in, such as a 32-bit file read as 24-bit pixels,
+changes the headers to describe the file save will write.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::convert_headers() {
+    const bool alpha = Format::file_bits_per_pixel == ALPHA_BITS_PER_PIXEL;
+    const bool palette =
+        Format::file_bits_per_pixel == PALETTE_BITS_PER_PIXEL;
+    InfoHeader target = _infoheader;
+    target.size = Format::file_infoheader_size;
+    target.bits_per_pixel = Format::file_bits_per_pixel;
+    target.compression = alpha ? BITFIELDS_COMPRESSION : CORRECT_COMPRESSION;
+    target.colors_used = palette ? PALETTE_COLORS : CORRECT_COLORS_USED;
+    target.important_colors = CORRECT_IMPORTANT_COLORS;
+    target.red_mask = alpha ? 0x00ff0000 : 0;
+    target.green_mask = alpha ? 0x0000ff00 : 0;
+    target.blue_mask = alpha ? 0x000000ff : 0;
+    target.alpha_mask = alpha ? 0xff000000 : 0;
+    if (target.size == _infoheader.size &&
+        target.bits_per_pixel == _infoheader.bits_per_pixel &&
+        target.compression == _infoheader.compression &&
+        target.colors_used == _infoheader.colors_used &&
+        target.important_colors == _infoheader.important_colors &&
+        target.red_mask == _infoheader.red_mask &&
+        target.green_mask == _infoheader.green_mask &&
+        target.blue_mask == _infoheader.blue_mask &&
+        target.alpha_mask == _infoheader.alpha_mask &&
+        _header.data_offset == FILE_HEADERS_SIZE) return;
+    _infoheader = target;
+    _header.data_offset = FILE_HEADERS_SIZE;
+    _header.file_size = calculate_size();
+    _infoheader.image_size = _header.file_size - FILE_HEADERS_SIZE;
+}
+
+/*
+Helper method for matching the headers to the dimensions of the
+pixels: the width and height, the padding and the file size, and the
+image size unless it is zero.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::resize_headers() {
+    _infoheader.width = _pixels.width();
+    _infoheader.height = _pixels.height();
+    _padding = row_padding();
+    _header.file_size = calculate_size();
+    if (_infoheader.image_size != 0)
+        _infoheader.image_size = _header.file_size - FILE_HEADERS_SIZE;
+}
+
+// Default constructor.
+template <typename Format, typename Allocator>
+BasicBitmapParser<Format, Allocator>::BasicBitmapParser()
+    : _fileptr(nullptr), _header(Header()),
+    _infoheader(InfoHeader()),
+    _pixels(Buffer()),
+    _padding(0), _threads(1) {}
+
+// Overloaded ctor for allocating the pixels with alloc.
+template <typename Format, typename Allocator>
+BasicBitmapParser<Format, Allocator>::BasicBitmapParser(
+    const Allocator& alloc)
+    : _fileptr(nullptr), _header(Header()),
+    _infoheader(InfoHeader()),
+    _pixels(alloc),
+    _padding(0), _threads(1), _staging(ByteAllocator(alloc)) {}
+
+// Overloaded ctor for C-string filename.
+template <typename Format, typename Allocator>
+BasicBitmapParser<Format, Allocator>::BasicBitmapParser(const char* filename,
+    const Allocator& alloc)
+    : _fileptr(nullptr), _header(Header()),
+    _infoheader(InfoHeader()),
+    _pixels(alloc),
+    _padding(0), _threads(1), _staging(ByteAllocator(alloc)) {
+    import(filename);
+}
+
+// Overloaded ctor for C++ string filename.
+template <typename Format, typename Allocator>
+BasicBitmapParser<Format, Allocator>::BasicBitmapParser(
+    const std::string& filename, const Allocator& alloc)
+    : _fileptr(nullptr), _header(Header()),
+    _infoheader(InfoHeader()),
+    _pixels(alloc),
+    _padding(0), _threads(1), _staging(ByteAllocator(alloc)) {
+    import(filename.c_str());
+}
+
+/*
+Move ctor. Takes over the pixels and staging buffer without copying,
+leaving other as if clear_data was called on it.
+*/
+template <typename Format, typename Allocator>
+BasicBitmapParser<Format, Allocator>::BasicBitmapParser(
+    BasicBitmapParser&& other) noexcept(
+    std::is_nothrow_move_constructible<Storage>::value)
+    : _fileptr(nullptr), _header(other._header),
+    _infoheader(other._infoheader),
+    _pixels(std::move(other._pixels)),
+    _padding(other._padding), _threads(other._threads),
+    _staging(std::move(other._staging)) {
+    other.clear_data();
+}
+
+// Move assignment, same as the move ctor.
+template <typename Format, typename Allocator>
+BasicBitmapParser<Format, Allocator>&
+BasicBitmapParser<Format, Allocator>::operator=(
+    BasicBitmapParser&& other) noexcept(
+    std::is_nothrow_move_assignable<Storage>::value) {
+    if (this != &other) {
+        _fileptr = nullptr;
+        _header = other._header;
+        _infoheader = other._infoheader;
+        _pixels = std::move(other._pixels);
+        _padding = other._padding;
+        _threads = other._threads;
+        _staging = std::move(other._staging);
+        other.clear_data();
+    }
+    return *this;
+}
+
+// Accessor for header struct.
+template <typename Format, typename Allocator>
+const Header& BasicBitmapParser<Format, Allocator>::read_header() const {
+    return _header;
+}
+
+// Mutator for header struct as reference.
+template <typename Format, typename Allocator>
+Header& BasicBitmapParser<Format, Allocator>::header() {
+    return _header;
+}
+
+// Mutator for replacing header struct.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::replace_header(
+    const Header& new_header) {
+    // Shallow copy is fine, no pointers.
+    _header = new_header;
+}
+
+// Accessor for info header struct.
+template <typename Format, typename Allocator>
+const InfoHeader&
+BasicBitmapParser<Format, Allocator>::read_infoheader() const {
+    return _infoheader;
+}
+
+// Mutator for info header struct as reference.
+template <typename Format, typename Allocator>
+InfoHeader& BasicBitmapParser<Format, Allocator>::infoheader() {
+    return _infoheader;
+}
+
+// Mutator for replacing infoheader struct.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::replace_infoheader(
+    const InfoHeader& new_infoheader) {
+    // Shallow copy is fine, no pointers.
+    _infoheader = new_infoheader;
+}
+
+// Accessor for pixels as a read only view.
+template <typename Format, typename Allocator>
+typename BasicBitmapParser<Format, Allocator>::ConstView
+BasicBitmapParser<Format, Allocator>::read_pixels() const {
+    return _pixels.view();
+}
+
+// Mutator for pixels as a writable view.
+template <typename Format, typename Allocator>
+typename BasicBitmapParser<Format, Allocator>::View
+BasicBitmapParser<Format, Allocator>::pixels() {
+    return _pixels.view();
+}
+
+// Mutator for replacing pixels from a vector of rows.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::replace_pixels(
+    const std::vector<std::vector<PixelType> >& new_pixels) {
+    // Copies the rows into the contiguous buffer.
+    _pixels.assign(new_pixels);
+}
+
+// Mutator for replacing pixels from another buffer.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::replace_pixels(
+    const Buffer& new_pixels) {
+    _pixels = new_pixels;
+}
+
+// Mutator for replacing pixels by moving in another buffer.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::replace_pixels(Buffer&& new_pixels) {
+    _pixels = std::move(new_pixels);
+}
+
+/*
+Moves the pixels out without copying, leaving this image with none.
+The width and height in the info header become zero to match.
+*/
+template <typename Format, typename Allocator>
+typename BasicBitmapParser<Format, Allocator>::Buffer
+BasicBitmapParser<Format, Allocator>::take_pixels() {
+    Buffer taken(std::move(_pixels));
+    resize_headers();
+    return taken;
+}
+
+/*
+Takes over a vector of width * height pixels, row after row from the
+top, without copying, and changes the headers to the new dimensions.
+Throws std::invalid_argument if the count is wrong, leaving
+new_pixels and this image as they were.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::adopt_pixels(
+    Storage&& new_pixels, size_t width, size_t height) {
+    _pixels = Buffer(std::move(new_pixels), width, height);
+    resize_headers();
+}
+
+// Accessor for the allocator of the pixels.
+template <typename Format, typename Allocator>
+Allocator BasicBitmapParser<Format, Allocator>::get_allocator() const {
+    return _pixels.get_allocator();
+}
+
+// Accessor for padding.
+template <typename Format, typename Allocator>
+const size_t BasicBitmapParser<Format, Allocator>::read_padding() const {
+    return _padding;
+}
+
+// Mutator for padding.
+template <typename Format, typename Allocator>
+size_t BasicBitmapParser<Format, Allocator>::padding() {
+    return _padding;
+}
+
+// Mutator for replacing padding.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::replace_padding(size_t new_padding) {
+    _padding = new_padding;
+}
+
+// Accessor for the number of threads used by color filters.
+template <typename Format, typename Allocator>
+size_t BasicBitmapParser<Format, Allocator>::read_threads() const {
+    return _threads;
+}
+
+/*
+Mutator for the number of threads used by color filters.
+Zero uses every hardware thread.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::replace_threads(size_t new_threads) {
+    _threads = new_threads;
+}
+
+/*
+Returns the number of bytes for row padding for a given width,
+in the files this format is saved as.
+This function is static - it can be used as a padding calculator
+on its own without making an instance of BitmapParser.
+*/
+template <typename Format, typename Allocator>
+size_t BasicBitmapParser<Format, Allocator>::row_padding(size_t width) {
+    // Each row must be a multiple of a dword (4 bytes)
+    size_t remainder = (width * FILE_BYTES_PER_PIXEL) % DWORD;
+    if (remainder == 0) {
+        return 0;
+    } else {
+        return (DWORD - remainder);
+    }
+}
+
+// Overload: if no parameters are passed, uses current width.
+template <typename Format, typename Allocator>
+size_t BasicBitmapParser<Format, Allocator>::row_padding() const {
+    return row_padding(_infoheader.width);
+}
+
+/*
+Returns the file size given width and height.
+This function is static - it can be used as a size calculator
+on its own without making an instance of BitmapParser.
+*/
+template <typename Format, typename Allocator>
+size_t BasicBitmapParser<Format, Allocator>::calculate_size(size_t width,
+    size_t height) {
+    return ((((FILE_BYTES_PER_PIXEL * width) +
+        row_padding(width)) * height) + FILE_HEADERS_SIZE);
+}
+
+// Overload: if no parameters are passed, uses current width and height.
+template <typename Format, typename Allocator>
+size_t BasicBitmapParser<Format, Allocator>::calculate_size() const {
+    return calculate_size(_infoheader.width, _infoheader.height);
+}
+
+/*
+Reads the headers of a bitmap file, and nothing else, to describe it.
+Files that cannot be opened, are cut short or would not be imported
+are returned as not valid instead of throwing, so this can be run
+over many files that may not be bitmaps.
+This function is static - it can be used without making an instance
+of BitmapParser.
+*/
+template <typename Format, typename Allocator>
+BitmapInfo BasicBitmapParser<Format, Allocator>::probe(const char* filename) {
+    BITMAPPARSER_MEASURE("probe");
+    BitmapInfo info = BitmapInfo();
+    FILE* fileptr = fopen(filename, "rb");
+    if (fileptr == nullptr) return info;
+    uint8_t buffer[CORRECT_TOTAL_HEADER_SIZE + MASKS_SIZE + DWORD];
+    const size_t length = fread(buffer, sizeof(char), sizeof(buffer),
+        fileptr);
+    fclose(fileptr);
+    BITMAPPARSER_RECORD(bytes_read, length);
+    Header header;
+    InfoHeader infoheader;
+    if (!decode_headers(buffer, length, &header, &infoheader) ||
+        header.signature != CORRECT_SIG) return info;
+    info.valid = readable(header, infoheader);
+    info.width = infoheader.width;
+    info.height = infoheader.height;
+    info.bits_per_pixel = infoheader.bits_per_pixel;
+    if (info.valid)
+        info.expected_size = calculate_size(info.width, info.height);
+    return info;
+}
+
+// Overload for std::string filename.
+template <typename Format, typename Allocator>
+BitmapInfo BasicBitmapParser<Format, Allocator>::probe(
+    const std::string& filename) {
+    return probe(filename.c_str());
+}
+
+// Reads and parses a bitmap file.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::import(const char* filename) {
+    /*
+    Open and check for success.
+    FYI - Visual Studio debugger requires absolute path.
+    */
+    BITMAPPARSER_MEASURE_IMAGE("import");
+    _fileptr = fopen(filename, "rb");
+    if (_fileptr == nullptr) throw FileOpenException();
+    try {
+        import_pixels();
+    } catch (...) {
+        // Close the file so failed imports do not leak it.
+        fclose(_fileptr);
+        throw;
+    }
+    BITMAPPARSER_RECORD(bytes_read, static_cast<size_t>(ftell(_fileptr)));
+    BITMAPPARSER_RECORD(pixels, _pixels.pixel_count());
+    // Close the file.
+    fclose(_fileptr);
+}
+
+// Helper method for import, reading everything after opening the file.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::import_pixels() {
+    // Import the header, info header and masks via helper.
+    import_headers();
+    // Check correctness and compatibility of the image.
+    FileLayout layout;
+    if (!readable(_header, _infoheader) ||
+        !file_layout(_infoheader, &layout)) throw InvalidFormatException();
+    // 8-bit images have a palette, which the pixels are looked up in.
+    Storage palette(_pixels.get_allocator());
+    if (layout.bytes_per_pixel == 1) import_palette(&palette);
+    // Skip anything between the headers and the pixels.
+    if (static_cast<long>(_header.data_offset) != ftell(_fileptr))
+        fseek(_fileptr, _header.data_offset, SEEK_SET);
+    // Allocate the pixel buffer in one go.
+    _pixels.resize(_infoheader.width, _infoheader.height);
+    /*
+    Finally, read the pixels bottom-up. The start of the pixel data
+    contains the bottom left pixel.
+    Using int for row due to complications with decrementing for loops
+    and unsigned values.
+    */
+    const size_t row_bytes = _infoheader.width * layout.bytes_per_pixel;
+    const size_t file_padding = (DWORD - row_bytes % DWORD) % DWORD;
+    _staging.resize(row_bytes + file_padding);
+    for (int row = _pixels.height() - 1; row >= 0; --row) {
+        /*
+        Read the whole row along with its padding in one call.
+        The padding of the last row is not read, since some files
+        end without it.
+        */
+        const size_t count =
+            (row == 0) ? row_bytes : row_bytes + file_padding;
+        check_read(_staging.data(), sizeof(char), count, _fileptr);
+        // Convert from the layout of the file.
+        if (palette.empty()) {
+            file_to_format<Format>(_staging.data(), layout,
+                _pixels[row].data(), _pixels.width());
+        } else {
+            palette_to_format(_staging.data(), palette.data(),
+                _pixels[row].data(), _pixels.width());
+        }
+    }
+    // Describe the file this image will be saved as.
+    convert_headers();
+    _padding = row_padding();
+}
+
+/*
+Reads and parses a bitmap file on up to threads threads.
+Rows sit at fixed offsets in the file, so each thread reads and
+converts its own band of rows with pread. Zero uses every hardware
+thread. Falls back to import(filename) where pread is unavailable.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::import(const char* filename,
+    size_t threads) {
+#ifdef BITMAPPARSER_HAS_PREAD
+    BITMAPPARSER_MEASURE_IMAGE("import");
+    threads = RowBandScheduler::shared_threads(threads);
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) throw FileOpenException();
+    try {
+        // Read the headers and masks in one go and decode them.
+        uint8_t headers[CORRECT_TOTAL_HEADER_SIZE + MASKS_SIZE + DWORD];
+        const size_t length = read_at(fd, headers, sizeof(headers), 0);
+        if (!decode_headers(headers, length, &_header, &_infoheader))
+            throw EOFException();
+        FileLayout layout;
+        if (!readable(_header, _infoheader) ||
+            !file_layout(_infoheader, &layout))
+            throw InvalidFormatException();
+        // 8-bit images have a palette, which the pixels are looked up in.
+        Storage palette(_pixels.get_allocator());
+        if (layout.bytes_per_pixel == 1) {
+            uint8_t buffer[PALETTE_SIZE];
+            const size_t bytes = palette_colors(_infoheader) * DWORD;
+            if (read_at(fd, buffer, bytes,
+                CORRECT_HEADER_SIZE + _infoheader.size) != bytes)
+                throw EOFException();
+            decode_palette(buffer, bytes / DWORD, &palette);
+        }
+        _pixels.resize(_infoheader.width, _infoheader.height);
+        const size_t width = _pixels.width();
+        const size_t height = _pixels.height();
+        const size_t row_bytes = width * layout.bytes_per_pixel;
+        const size_t file_padding = (DWORD - row_bytes % DWORD) % DWORD;
+        const size_t stride = row_bytes + file_padding;
+        const size_t data_offset = _header.data_offset;
+        // Each band is read in chunks of about 4 MB.
+        const size_t chunk_rows = std::max<size_t>(1, (1 << 22) / stride);
+        RowBandScheduler::shared().run(height, threads,
+            [&](size_t row_begin, size_t row_end) {
+            std::vector<uint8_t> buffer;
+            for (size_t chunk = row_begin; chunk < row_end;
+                chunk += chunk_rows) {
+                /*
+                Image rows [chunk, chunk + count) are one block in the
+                file, stored bottom-up. Like import, the last row in the
+                file (the top row) may be missing its padding.
+                */
+                const size_t count = std::min(chunk_rows, row_end - chunk);
+                const size_t first_file_row = height - chunk - count;
+                size_t bytes = count * stride;
+                if (chunk == 0) bytes -= file_padding;
+                buffer.resize(count * stride);
+                if (read_at(fd, buffer.data(), bytes,
+                    data_offset + first_file_row * stride) != bytes)
+                    throw EOFException();
+                for (size_t i = 0; i < count; ++i) {
+                    const uint8_t* row =
+                        buffer.data() + (count - 1 - i) * stride;
+                    if (palette.empty()) {
+                        file_to_format<Format>(row, layout,
+                            _pixels[chunk + i].data(), width);
+                    } else {
+                        palette_to_format(row, palette.data(),
+                            _pixels[chunk + i].data(), width);
+                    }
+                }
+            }
+        });
+        BITMAPPARSER_RECORD(bytes_read, data_offset +
+            height * stride - (height ? file_padding : 0));
+        convert_headers();
+        _padding = row_padding();
+        BITMAPPARSER_RECORD(pixels, _pixels.pixel_count());
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+#else
+    (void)threads;
+    import(filename);
+#endif
+}
+
+/*
+Writes a bitmap file on up to threads threads, each encoding
+its own band of rows and writing it with pwrite.
+The output is the same as save(filename). Zero uses every hardware
+thread. Falls back to save(filename) where pwrite is unavailable.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::save(const char* filename,
+    size_t threads) {
+#ifdef BITMAPPARSER_HAS_PREAD
+    BITMAPPARSER_MEASURE_IMAGE("save");
+    threads = RowBandScheduler::shared_threads(threads);
+    const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw FileOpenException();
+    try {
+        // Write both headers and any palette in one go.
+        uint8_t headers[MAX_HEADERS_SIZE];
+        const size_t headers_size = encode_headers(_header, _infoheader,
+            headers);
+        write_at(fd, headers, headers_size, 0);
+        const size_t width = _pixels.width();
+        const size_t height = _pixels.height();
+        const size_t row_bytes = width * FILE_BYTES_PER_PIXEL;
+        const size_t stride = row_bytes + _padding;
+        // Each band is written in chunks of about 4 MB.
+        const size_t chunk_rows = std::max<size_t>(1, (1 << 22) / stride);
+        RowBandScheduler::shared().run(height, threads,
+            [&](size_t row_begin, size_t row_end) {
+            std::vector<uint8_t> buffer;
+            for (size_t chunk = row_begin; chunk < row_end;
+                chunk += chunk_rows) {
+                // Encode the chunk bottom-up, as one block of the file.
+                const size_t count = std::min(chunk_rows, row_end - chunk);
+                const size_t first_file_row = height - chunk - count;
+                buffer.assign(count * stride, 0x0);
+                for (size_t i = 0; i < count; ++i) {
+                    format_to_file<Format>(_pixels[chunk + i].data(),
+                        buffer.data() + (count - 1 - i) * stride, width);
+                }
+                write_at(fd, buffer.data(), buffer.size(),
+                    headers_size + first_file_row * stride);
+            }
+        });
+        BITMAPPARSER_RECORD(bytes_written,
+            headers_size + height * stride);
+        BITMAPPARSER_RECORD(pixels, _pixels.pixel_count());
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    if (close(fd) != 0) throw IOException();
+#else
+    (void)threads;
+    save(filename);
+#endif
+}
+
+// Writes a bitmap file.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::save(const char* filename) {
+    /*
+     Open and check for success.
+     FYI - Visual Studio debugger requires absolute path.
+     */
+    BITMAPPARSER_MEASURE_IMAGE("save");
+    _fileptr = fopen(filename, "wb");
+    if (_fileptr == nullptr) throw FileOpenException();
+    try {
+        // Write the header, info header and any palette via helper.
+        write_headers(_header, _infoheader);
+        // Finally, write the pixels via helper.
+        write_pixels(_pixels.view(), _padding);
+    } catch (...) {
+        fclose(_fileptr);
+        throw;
+    }
+    BITMAPPARSER_RECORD(bytes_written,
+        static_cast<size_t>(ftell(_fileptr)));
+    BITMAPPARSER_RECORD(pixels, _pixels.pixel_count());
+    // Close the file.
+    fclose(_fileptr);
+}
+
+/*
+Writes a view, such as a region of this image, as a bitmap file.
+The header and info header are copied from this image, with the
+dimensions, file size and image size changed to match the view.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::save(const char* filename,
+    ConstView view) {
+    BITMAPPARSER_MEASURE_IMAGE("save");
+    BITMAPPARSER_RECORD(pixels, view.width() * view.height());
+    Header header = _header;
+    InfoHeader infoheader = _infoheader;
+    infoheader.width = view.width();
+    infoheader.height = view.height();
+    header.file_size = calculate_size(view.width(), view.height());
+    // Zero is allowed for uncompressed images, so it stays zero.
+    if (infoheader.image_size != 0)
+        infoheader.image_size = header.file_size - FILE_HEADERS_SIZE;
+    _fileptr = fopen(filename, "wb");
+    if (_fileptr == nullptr) throw FileOpenException();
+    try {
+        write_headers(header, infoheader);
+        write_pixels(view, row_padding(view.width()));
+    } catch (...) {
+        fclose(_fileptr);
+        throw;
+    }
+    BITMAPPARSER_RECORD(bytes_written,
+        static_cast<size_t>(ftell(_fileptr)));
+    fclose(_fileptr);
+}
+
+/*
+Helper method for writing the pixels bottom-up. The start of the file
+after the header/info header should contain the bottom left pixel.
+Pixels must be written in blue, green, red order.
+Using int for row due to complications with decrementing for loops
+and unsigned values.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::write_pixels(ConstView view,
+    size_t padding) {
+    const size_t row_bytes = view.width() * FILE_BYTES_PER_PIXEL;
+    /*
+    Staging buffer for one row. The padding at the end is
+    filled with zero bytes once and never overwritten.
+    */
+    _staging.assign(row_bytes + padding, 0x0);
+    for (int row = view.height() - 1; row >= 0; --row) {
+        // Convert to blue, green, red order, then write row and padding.
+        format_to_file<Format>(view[row].data(), _staging.data(),
+            view.width());
+        check_write(_staging.data(), sizeof(char), _staging.size(),
+            _fileptr);
+    }
+}
+
+// Clears all state stored in this instance.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::clear_data() {
+    _fileptr = nullptr;
+    _header = Header();
+    _infoheader = InfoHeader();
+    // Give the memory back to the allocator, not just the pixels.
+    _pixels = Buffer(_pixels.get_allocator());
+    std::vector<uint8_t, ByteAllocator>(_staging.get_allocator()).swap(
+        _staging);
+    _padding = 0;
+}
+
+// Prints information about the header and info header.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::print_metadata(bool hex) const {
+    // For displaying text dividers.
+    const std::string div = "========================================";
+    if (hex) {
+        std::cout << "Number base: hexadecimal\n\n";
+    } else {
+        std::cout << "Number base: decimal\n\n";
+    }
+    std::cout << "HEADER\n" << div <<
+        "\nSignature (hexadecimal): 0x" <<
+        std::hex << _header.signature;
+    // Determine hex or decimal.
+    if (!hex) std::cout << std::dec;
+    std::cout << "\nFile Size (Bytes): " <<
+        _header.file_size <<
+        "\nReserved Flags: " <<
+        _header.reserved <<
+        "\nData Offset (Bytes): " <<
+        _header.data_offset <<
+        "\n\nINFO HEADER\n" << div <<
+        "\nInfo Header Size (Bytes): " <<
+        _infoheader.size <<
+        "\nImage Width (Pixels): " <<
+        _infoheader.width <<
+        "\nImage Height (Pixels): " <<
+        _infoheader.height <<
+        "\nPlanes: " <<
+        _infoheader.planes <<
+        "\nBits Per Pixel: " <<
+        _infoheader.bits_per_pixel <<
+        "\nCompression Type: " <<
+        _infoheader.compression <<
+        "\nCompressed Image Size (Bytes): " <<
+        _infoheader.image_size <<
+        "\nHorizontal Resolution (Pixels/Meter): " <<
+        _infoheader.x_pixels_per_meter <<
+        "\nVertical Resolution (Pixels/Meter): " <<
+        _infoheader.y_pixels_per_meter <<
+        "\nNumber of Actually Used Colors: " <<
+        _infoheader.colors_used <<
+        "\nNumber of Important Colors: " <<
+        _infoheader.important_colors << "\n\n";
+    // Masks are always shown in hexadecimal.
+    if (has_masks(_infoheader)) {
+        std::cout << "MASKS (hexadecimal)\n" << div << std::hex <<
+            "\nRed: 0x" << _infoheader.red_mask <<
+            "\nGreen: 0x" << _infoheader.green_mask <<
+            "\nBlue: 0x" << _infoheader.blue_mask <<
+            "\nAlpha: 0x" << _infoheader.alpha_mask << "\n\n" << std::dec;
+    }
+}
+
+/*
+Prints information about pixels, by row. Lists padding as well.
+Output may be long - recommended to pipe to file.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::print_pixels(bool hex) const {
+    if (hex) {
+        std::cout << "Number base: hexadecimal\n\n";
+    } else {
+        std::cout << "Number base: decimal\n\n";
+    }
+    // Channels of the format, in the order they are printed.
+    const char* channels = !Format::has_color ? " (Gray)" :
+        Format::has_alpha ? " (R/G/B/A)" : " (R/G/B)";
+    for (size_t row = 0; row < _infoheader.height; ++row) {
+        std::cout << std::dec << "Row " << row << channels <<
+            "\n==============================\n";
+        for (size_t col = 0; col < _infoheader.width; ++col) {
+            const uint8_t* pix =
+                reinterpret_cast<const uint8_t*>(&_pixels[row][col]);
+            std::cout << std::dec << "Col " << col << ":\t\t";
+            if (hex) std::cout << std::hex;
+            // Cout can't print uint8_t without unsigned().
+            if (Format::has_color) {
+                std::cout << unsigned(pix[Format::red]) << ' ' <<
+                    unsigned(pix[Format::green]) << ' ' <<
+                    unsigned(pix[Format::blue]);
+            } else {
+                std::cout << unsigned(pix[0]);
+            }
+            if (Format::has_alpha) std::cout << ' ' << unsigned(pix[3]);
+            std::cout << '\n';
+        }
+        // Padding is 0-3 bytes, same notation in decimal and hex.
+        std::cout << "Padding Bytes: " << _padding << "\n\n";
+    }
+}
+
+// Flips the image horizontally.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::flip_horizontal() {
+    BITMAPPARSER_MEASURE_IMAGE("flip_horizontal");
+    BITMAPPARSER_RECORD(pixels, _pixels.pixel_count());
+    for (Row row : _pixels.view()) {
+        std::reverse(row.begin(), row.end());
+    }
+}
+
+// Flips the image vertically.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::flip_vertical() {
+    BITMAPPARSER_MEASURE_IMAGE("flip_vertical");
+    BITMAPPARSER_RECORD(pixels, _pixels.pixel_count());
+    // Exchange whole rows, top and bottom, working inwards.
+    const size_t height = _pixels.height();
+    for (size_t row = 0; row < height / 2; ++row) {
+        swap_pixel_rows(_pixels[row], _pixels[height - 1 - row]);
+    }
+}
+
+/*
+Transposes the image. The nth row becomes the nth column,
+and vice versa.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::transpose() {
+    BITMAPPARSER_MEASURE_IMAGE("transpose");
+    BITMAPPARSER_RECORD(pixels, _pixels.pixel_count());
+    transpose(false, false);
+}
+
+// Rotates the image 90 degrees counterclockwise.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::rotate90_left() {
+    BITMAPPARSER_MEASURE_IMAGE("rotate90_left");
+    BITMAPPARSER_RECORD(pixels, _pixels.pixel_count());
+    // Transpose and reverse the rows in one pass.
+    transpose(true, false);
+}
+
+// Rotates the image 90 degrees clockwise.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::rotate90_right() {
+    BITMAPPARSER_MEASURE_IMAGE("rotate90_right");
+    BITMAPPARSER_RECORD(pixels, _pixels.pixel_count());
+    // Transpose and reverse the columns in one pass.
+    transpose(false, true);
+}
+
+/*
+Helper method for transposition and rotations.
+Optionally flips the transposed image vertically (reverse_rows)
+or horizontally (reverse_cols) while copying.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::transpose(bool reverse_rows,
+    bool reverse_cols) {
+    // New pixel buffer with width and height interchanged.
+    Buffer new_pixels(_pixels.height(), _pixels.width(),
+        _pixels.get_allocator());
+    transpose_pixels<PixelType>(_pixels.view(), new_pixels.view(),
+        reverse_rows, reverse_cols);
+    // Replace the pixel buffer.
+    _pixels.swap(new_pixels);
+    // Change width and height.
+    std::swap(_infoheader.width, _infoheader.height);
+    // Replace the padding, now that width is changed
+    _padding = row_padding();
+    /*
+    Calculate and change file size, may differ
+    due to row padding.
+    */
+    _header.file_size = calculate_size();
+}
+
+/*
+Crops the subset of _pixels from [x_begin, x_end) [y_begin, y_end).
+The end indices are exclusive, so (0, 0, width, height) keeps the
+whole image.
+Adjusts for metadata changes accordingly, which are:
+Header - file size
+Info Header - width and height
+(Since no compression is assumed, image size can remain zero.)
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::crop(size_t x_begin, size_t y_begin,
+    size_t x_end, size_t y_end) {
+    BITMAPPARSER_MEASURE_IMAGE("crop");
+    // Materialize the region into the pixel buffer.
+    _pixels.assign(read_region(x_begin, y_begin, x_end, y_end));
+    // Change width and height
+    _infoheader.width = _pixels.width();
+    _infoheader.height = _pixels.height();
+    // Replace the padding, now that width is changed
+    _padding = row_padding();
+    // Calculate and change file size
+    _header.file_size = calculate_size();
+    BITMAPPARSER_RECORD(pixels, _pixels.pixel_count());
+}
+
+/*
+Returns a writable view of the subset of _pixels from
+[x_begin, x_end) [y_begin, y_end), the same pixels crop would keep.
+Nothing is copied; the view is valid until the image is resized.
+*/
+template <typename Format, typename Allocator>
+typename BasicBitmapParser<Format, Allocator>::View
+BasicBitmapParser<Format, Allocator>::region(size_t x_begin, size_t y_begin,
+    size_t x_end, size_t y_end) {
+    check_region(x_begin, y_begin, x_end, y_end);
+    return _pixels.view().subview(x_begin, y_begin,
+        x_end - x_begin, y_end - y_begin);
+}
+
+// Read only version of region.
+template <typename Format, typename Allocator>
+typename BasicBitmapParser<Format, Allocator>::ConstView
+BasicBitmapParser<Format, Allocator>::read_region(size_t x_begin,
+    size_t y_begin,
+    size_t x_end, size_t y_end) const {
+    check_region(x_begin, y_begin, x_end, y_end);
+    return _pixels.view().subview(x_begin, y_begin,
+        x_end - x_begin, y_end - y_begin);
+}
+
+/*
+Helper method for checking the bounds of a region.
+Sanity check on indices. If negative ints are passed and casted
+to size_t they will overflow, so only four checks are needed:
+1. x_end is not greater than the width.
+2. x_begin is smaller or equal to x_end.
+3. y_end is not greater than the height.
+4. y_begin is smaller or equal to y_end.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::check_region(size_t x_begin,
+    size_t y_begin,
+    size_t x_end, size_t y_end) const {
+    if (!(x_end <= _infoheader.width))
+        throw std::out_of_range(
+            "x_end must be smaller than or equal to width!\n");
+    else if (!(x_begin <= x_end))
+        throw std::out_of_range(
+            "x_begin must be smaller than or equal to x_end!\n");
+    else if (!(y_end <= _infoheader.height))
+        throw std::out_of_range(
+            "y_end must be smaller than or equal to height!\n");
+    else if (!(y_begin <= y_end))
+        throw std::out_of_range(
+            "y_begin must be smaller than or equal to y_end!\n");
+}
+
+/*
+Superimposes another BitmapParser instance's image
+onto this instance's image at the desired position.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::superimpose(
+    const BasicBitmapParser& other, size_t x_begin, size_t y_begin) {
+    superimpose(other._pixels.view(), x_begin, y_begin);
+}
+
+/*
+Superimposes a view, such as a region of another image,
+onto this instance's image at the desired position.
+*/
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::superimpose(ConstView other,
+    size_t x_begin, size_t y_begin) {
+    BITMAPPARSER_MEASURE_IMAGE("superimpose");
+    BITMAPPARSER_RECORD(pixels, other.width() * other.height());
+    /*
+    Sanity check on indices. Negative ints passed will overflow,
+    so check just for the following:
+    1. x_begin + <width of other image> is smaller than this->width.
+    2. x_begin is smaller than this->width
+    (to account for overflow when other image width is added.)
+    3. y_begin + <height of other image> is smaller than this->height.
+    4. y_begin is smaller than this->height
+    (to account for overflow when other image height is added.)
+    */
+    if (!(x_begin < _infoheader.width && y_begin < _infoheader.height))
+        throw std::out_of_range(
+            "Invalid starting position!\n");
+    else if (!(x_begin + other.width() < _infoheader.width))
+        throw std::out_of_range(
+            "Width of superimposed image exceeds original!\n");
+    else if (!(y_begin + other.height() < _infoheader.height))
+        throw std::out_of_range(
+            "Height of superimposed image exceeds original!\n");
+    /*
+    Sanity checks passed, begin superimposing.
+    The view may be a region of this image that overlaps the
+    destination. Rows are then copied bottom-up when the source lies
+    above the destination, so every row is read before it is
+    overwritten, and memmove handles overlap within a row.
+    */
+    const size_t height = other.height();
+    const size_t row_bytes = other.width() * sizeof(PixelType);
+    const bool bottom_up = height > 0 && std::less<const PixelType*>()(
+        other[0].data(), _pixels[y_begin].data() + x_begin);
+    for (size_t i = 0; i < height; ++i) {
+        const size_t row = bottom_up ? height - 1 - i : i;
+        memmove(_pixels[y_begin + row].data() + x_begin,
+            other[row].data(), row_bytes);
+    }
+    // Image dimensions are identical, nothing to do.
+}
+
+// Inverts the colors of the image.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::invert_colors() {
+    invert_colors(_pixels.view(), _threads);
+}
+
+// Turns the image into grayscale using the average method.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::grayscale() {
+    grayscale(_pixels.view(), _threads);
+}
+
+// Sepia colored filter.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::sepia() {
+    sepia(_pixels.view(), _threads);
+}
+
+// Leave color values for red channel only.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::isolate_red() {
+    isolate_red(_pixels.view(), _threads);
+}
+
+// Leave color values for green channel only.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::isolate_green() {
+    isolate_green(_pixels.view(), _threads);
+}
+
+// Leave color values for blue channel only.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::isolate_blue() {
+    isolate_blue(_pixels.view(), _threads);
+}
+
+// Inverts the colors of a view.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::invert_colors(View view,
+    size_t threads) {
+    BITMAPPARSER_MEASURE("invert_colors");
+    BITMAPPARSER_RECORD(pixels, view.width() * view.height());
+    for_each_pixel_run(view, FormatKernels<Format>::invert, threads);
+}
+
+// Turns a view into grayscale using the average method.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::grayscale(View view,
+    size_t threads) {
+    BITMAPPARSER_MEASURE("grayscale");
+    BITMAPPARSER_RECORD(pixels, view.width() * view.height());
+    for_each_pixel_run(view, FormatKernels<Format>::grayscale, threads);
+}
+
+// Sepia colored filter on a view.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::sepia(View view, size_t threads) {
+    static_assert(Format::has_color, "sepia needs a color format");
+    BITMAPPARSER_MEASURE("sepia");
+    BITMAPPARSER_RECORD(pixels, view.width() * view.height());
+    for_each_pixel_run(view, FormatKernels<Format>::sepia, threads);
+}
+
+// Leave color values for red channel only in a view.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::isolate_red(View view,
+    size_t threads) {
+    static_assert(Format::has_color, "isolate_red needs a color format");
+    BITMAPPARSER_MEASURE("isolate_red");
+    BITMAPPARSER_RECORD(pixels, view.width() * view.height());
+    const Pixel mask = {0xff, 0x0, 0x0};
+    for_each_pixel_run(view, [&mask](PixelType* pixels, size_t count) {
+        FormatKernels<Format>::mask(pixels, count, mask);
+    }, threads);
+}
+
+// Leave color values for green channel only in a view.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::isolate_green(View view,
+    size_t threads) {
+    static_assert(Format::has_color, "isolate_green needs a color format");
+    BITMAPPARSER_MEASURE("isolate_green");
+    BITMAPPARSER_RECORD(pixels, view.width() * view.height());
+    const Pixel mask = {0x0, 0xff, 0x0};
+    for_each_pixel_run(view, [&mask](PixelType* pixels, size_t count) {
+        FormatKernels<Format>::mask(pixels, count, mask);
+    }, threads);
+}
+
+// Leave color values for blue channel only in a view.
+template <typename Format, typename Allocator>
+void BasicBitmapParser<Format, Allocator>::isolate_blue(View view,
+    size_t threads) {
+    static_assert(Format::has_color, "isolate_blue needs a color format");
+    BITMAPPARSER_MEASURE("isolate_blue");
+    BITMAPPARSER_RECORD(pixels, view.width() * view.height());
+    const Pixel mask = {0x0, 0x0, 0xff};
+    for_each_pixel_run(view, [&mask](PixelType* pixels, size_t count) {
+        FormatKernels<Format>::mask(pixels, count, mask);
+    }, threads);
+}
+
+/*
+Records color filters, flips and crops, and applies them all in a
+single pass over the image. Color filters do not depend on where a
+pixel is, so each output row is first copied from its place in the
+source, then run through every filter while it is still in cache.
+Operations are applied in the order they are recorded, so
+    pipeline.grayscale().invert_colors().flip_horizontal();
+    pipeline.apply(&image);
+gives the same image as calling the three functions on image.
+*/
+class BitmapPipeline {
+ public:
+    BitmapPipeline() {}
+
+    // Color filters.
+    BitmapPipeline& invert_colors() { return add_filter(INVERT); }
+    BitmapPipeline& grayscale() { return add_filter(GRAYSCALE); }
+    BitmapPipeline& sepia() { return add_filter(SEPIA); }
+    BitmapPipeline& isolate_red() { return add_filter(ISOLATE_RED); }
+    BitmapPipeline& isolate_green() { return add_filter(ISOLATE_GREEN); }
+    BitmapPipeline& isolate_blue() { return add_filter(ISOLATE_BLUE); }
+    // Image reflections.
+    BitmapPipeline& flip_horizontal();
+    BitmapPipeline& flip_vertical();
+    // Image cropping, with the same indices as BitmapParser::crop.
+    BitmapPipeline& crop(size_t x_begin, size_t y_begin,
+        size_t x_end, size_t y_end);
+    // Removes all recorded operations.
+    void clear();
+    bool empty() const { return _filters.empty() && _geometry.empty(); }
+    /*
+    Applies every operation to image, on as many threads as
+    image->read_threads(). Throws std::out_of_range, leaving image
+    unchanged, if a crop does not fit.
+    */
+    void apply(BitmapParser* image) const;
+    /*
+    Same as apply(image), but builds flipped or cropped images in
+    scratch, which is left holding the old pixels. Passing the same
+    scratch buffer for many images avoids allocating one per image.
+    */
+    void apply(BitmapParser* image, PixelBuffer* scratch) const;
+
+ private:
+    enum Filter {
+        INVERT, GRAYSCALE, SEPIA, ISOLATE_RED, ISOLATE_GREEN, ISOLATE_BLUE
+    };
+    enum Remap { FLIP_HORIZONTAL, FLIP_VERTICAL, CROP };
+    // A flip or a crop, with the crop indices if it is one.
+    struct GeometryStep {
+        Remap remap;
+        size_t x_begin;
+        size_t y_begin;
+        size_t x_end;
+        size_t y_end;
+    };
+
+    BitmapPipeline& add_filter(Filter filter);
+    // Runs every filter over count pixels.
+    void run_filters(Pixel* pixels, size_t count) const;
+
+    std::vector<Filter> _filters;
+    std::vector<GeometryStep> _geometry;
+};
+
+// Helper method for recording a color filter.
+inline BitmapPipeline& BitmapPipeline::add_filter(Filter filter) {
+    _filters.push_back(filter);
+    return *this;
+}
+
+// Records a horizontal flip.
+inline BitmapPipeline& BitmapPipeline::flip_horizontal() {
+    const GeometryStep step = {FLIP_HORIZONTAL, 0, 0, 0, 0};
+    _geometry.push_back(step);
+    return *this;
+}
+
+// Records a vertical flip.
+inline BitmapPipeline& BitmapPipeline::flip_vertical() {
+    const GeometryStep step = {FLIP_VERTICAL, 0, 0, 0, 0};
+    _geometry.push_back(step);
+    return *this;
+}
+
+// Records a crop. The indices are checked when the pipeline is applied.
+inline BitmapPipeline& BitmapPipeline::crop(size_t x_begin, size_t y_begin,
+    size_t x_end, size_t y_end) {
+    const GeometryStep step = {CROP, x_begin, y_begin, x_end, y_end};
+    _geometry.push_back(step);
+    return *this;
+}
+
+// Removes all recorded operations.
+inline void BitmapPipeline::clear() {
+    _filters.clear();
+    _geometry.clear();
+}
+
+// Helper method for running the filters in order.
+inline void BitmapPipeline::run_filters(Pixel* pixels, size_t count) const {
+    const ColorKernels& kernels = ColorKernels::best();
+    const Pixel red = {0xff, 0x0, 0x0};
+    const Pixel green = {0x0, 0xff, 0x0};
+    const Pixel blue = {0x0, 0x0, 0xff};
+    for (Filter filter : _filters) {
+        switch (filter) {
+            case INVERT: kernels.invert(pixels, count); break;
+            case GRAYSCALE: kernels.grayscale(pixels, count); break;
+            case SEPIA: kernels.sepia(pixels, count); break;
+            case ISOLATE_RED: kernels.mask(pixels, count, red); break;
+            case ISOLATE_GREEN: kernels.mask(pixels, count, green); break;
+            case ISOLATE_BLUE: kernels.mask(pixels, count, blue); break;
+        }
+    }
+}
+
+// Applies the pipeline with a temporary scratch buffer.
+inline void BitmapPipeline::apply(BitmapParser* image) const {
+    PixelBuffer scratch;
+    apply(image, &scratch);
+}
+
+/*
+Applies the pipeline. The flips and crops are first folded into one
+rectangle of the source and a flag per axis, then each output row
+is copied from the source and filtered.
+*/
+inline void BitmapPipeline::apply(BitmapParser* image,
+    PixelBuffer* scratch) const {
+    // Buffers are swapped, not reallocated, so none are watched.
+    BITMAPPARSER_MEASURE("pipeline");
+    PixelBuffer& source = image->_pixels;
+    // Source rectangle, and whether it is mirrored on each axis.
+    size_t x_offset = 0;
+    size_t y_offset = 0;
+    size_t width = source.width();
+    size_t height = source.height();
+    bool mirror_x = false;
+    bool mirror_y = false;
+    for (const GeometryStep& step : _geometry) {
+        if (step.remap == FLIP_HORIZONTAL) {
+            mirror_x = !mirror_x;
+        } else if (step.remap == FLIP_VERTICAL) {
+            mirror_y = !mirror_y;
+        } else {
+            // Same sanity checks as BitmapParser::crop.
+            if (!(step.x_end <= width))
+                throw std::out_of_range(
+                    "x_end must be smaller than or equal to width!\n");
+            else if (!(step.x_begin <= step.x_end))
+                throw std::out_of_range(
+                    "x_begin must be smaller than or equal to x_end!\n");
+            else if (!(step.y_end <= height))
+                throw std::out_of_range(
+                    "y_end must be smaller than or equal to height!\n");
+            else if (!(step.y_begin <= step.y_end))
+                throw std::out_of_range(
+                    "y_begin must be smaller than or equal to y_end!\n");
+            // A mirrored axis is cropped from the other end.
+            x_offset += mirror_x ? width - step.x_end : step.x_begin;
+            y_offset += mirror_y ? height - step.y_end : step.y_begin;
+            width = step.x_end - step.x_begin;
+            height = step.y_end - step.y_begin;
+        }
+    }
+    const ConstPixelView from = source.view().subview(x_offset, y_offset,
+        width, height);
+    BITMAPPARSER_RECORD(pixels, width * height);
+    // Without flips or crops, filter in place.
+    const bool in_place = _geometry.empty();
+    if (!in_place) scratch->resize(width, height);
+    PixelView to = in_place ? source.view() : scratch->view();
+    const size_t threads = RowBandScheduler::shared_threads(
+        image->read_threads());
+    RowBandScheduler::shared().run(height, threads,
+        [&](size_t row_begin, size_t row_end) {
+        for (size_t row = row_begin; row < row_end; ++row) {
+            PixelRow dst = to[row];
+            if (!in_place) {
+                ConstPixelRow src = from[mirror_y ? height - 1 - row : row];
+                if (mirror_x) {
+                    std::reverse_copy(src.begin(), src.end(), dst.begin());
+                } else {
+                    std::copy(src.begin(), src.end(), dst.begin());
+                }
+            }
+            run_filters(dst.data(), dst.size());
+        }
+    });
+    if (in_place) return;
+    // Swap in the new pixels and update the metadata, as crop does.
+    source.swap(*scratch);
+    image->_infoheader.width = width;
+    image->_infoheader.height = height;
+    image->_padding = image->row_padding();
+    image->_header.file_size = image->calculate_size();
+}
+
+/*
+Runs a pipeline over many bitmap files on a pool of worker threads.
+Each worker imports a file, applies the pipeline and saves the
+result, reusing one BitmapParser and its buffers for all of its
+files, so small images are not allocated one by one. Workers take
+the next file as they finish, so large files do not hold up the rest.
+*/
+class BatchProcessor {
+ public:
+    // A file that could not be processed, and why.
+    struct Failure {
+        size_t index;
+        std::string input;
+        std::string message;
+    };
+
+    // Zero threads uses every hardware thread.
+    explicit BatchProcessor(size_t threads = 0) : _threads(threads) {}
+
+    // Queues input to be processed and saved to output.
+    void add(const std::string& input, const std::string& output);
+    size_t size() const { return _jobs.size(); }
+    // Removes all queued files.
+    void clear() { _jobs.clear(); }
+    /*
+    Processes every queued file. Errors do not stop the batch; they
+    are returned instead, ordered by the index of the file.
+    */
+    std::vector<Failure> run(const BitmapPipeline& pipeline) const;
+
+ private:
+    struct Job {
+        std::string input;
+        std::string output;
+    };
+
+    std::vector<Job> _jobs;
+    size_t _threads;
+};
+
+// Queues a file.
+inline void BatchProcessor::add(const std::string& input,
+    const std::string& output) {
+    const Job job = {input, output};
+    _jobs.push_back(job);
+}
+
+/*
+Processes the queued files. Each "row" handed to the scheduler is a
+worker, which pulls file indices from a shared counter. The batch gets
+a scheduler of its own, since holding the shared one until every file
+is done would block the filters, imports and saves of every other
+image in the process.
+*/
+inline std::vector<BatchProcessor::Failure> BatchProcessor::run(
+    const BitmapPipeline& pipeline) const {
+    size_t threads = _threads;
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    threads = std::max<size_t>(1, std::min(threads, _jobs.size()));
+    std::atomic<size_t> next(0);
+    std::mutex failures_mutex;
+    std::vector<Failure> failures;
+    RowBandScheduler scheduler(threads);
+    scheduler.run(threads, threads,
+        [&](size_t worker_begin, size_t worker_end) {
+        // Every worker keeps its own image and scratch buffer.
+        BitmapParser image;
+        PixelBuffer scratch;
+        std::vector<Failure> worker_failures;
+        for (size_t worker = worker_begin; worker < worker_end; ++worker) {
+            for (size_t i = next++; i < _jobs.size(); i = next++) {
+                try {
+                    image.import(_jobs[i].input.c_str());
+                    pipeline.apply(&image, &scratch);
+                    image.save(_jobs[i].output.c_str());
+                } catch (const std::exception& e) {
+                    const Failure failure = {i, _jobs[i].input, e.what()};
+                    worker_failures.push_back(failure);
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(failures_mutex);
+        failures.insert(failures.end(), worker_failures.begin(),
+            worker_failures.end());
+    });
+    std::sort(failures.begin(), failures.end(),
+        [](const Failure& a, const Failure& b) { return a.index < b.index; });
+    return failures;
+}
+
+/*
+Streaming reader for bitmap files.
+Only the headers are read up front, and rows are then decoded
+one at a time or in bands, so memory use depends on the width
+of the image and not its height.
+Rows can be returned bottom-up as stored in the file, or top-down.
+*/
+class BitmapReader {
+ public:
+    // Order in which rows are returned.
+    enum RowOrder { BOTTOM_UP, TOP_DOWN };
+
+    explicit BitmapReader(const char* filename, RowOrder order = BOTTOM_UP);
+    explicit BitmapReader(const std::string& filename,
+        RowOrder order = BOTTOM_UP);
+    ~BitmapReader();
+    // The file is owned, so copying is not allowed.
+    BitmapReader(const BitmapReader&) = delete;
+    BitmapReader& operator=(const BitmapReader&) = delete;
+
+    // Header and info header accessors.
+    const Header& read_header() const { return _header; }
+    const InfoHeader& read_infoheader() const { return _infoheader; }
+    size_t width() const { return _infoheader.width; }
+    size_t height() const { return _infoheader.height; }
+    RowOrder order() const { return _order; }
+    // Number of rows not read yet.
+    size_t rows_remaining() const { return height() - _rows_read; }
+    // Index of the next row to be read, with row 0 at the top.
+    size_t next_row() const;
+    /*
+    Reads the next row, resizing it to the width of the image.
+    Returns false once all rows have been read.
+    */
+    bool read_row(std::vector<Pixel>* row);
+    /*
+    Reads up to max_rows of the next rows into band, in reading order.
+    Returns the number of rows read, which is zero at the end.
+    */
+    size_t read_band(size_t max_rows, PixelBuffer* band);
+
+ private:
+    // Opens the file and parses its headers.
+    void open_file(const char* filename);
+    // Decodes the next count rows into dst, rows dst_stride apart.
+    void read_rows(size_t count, Pixel* dst, size_t dst_stride);
+
+    FILE* _fileptr;
+    Header _header;
+    InfoHeader _infoheader;
+    RowOrder _order;
+    // Bytes from one row to the next in the file, including padding.
+    size_t _stride;
+    size_t _rows_read;
+    // Staging buffer for raw file rows.
+    std::vector<uint8_t> _buffer;
+};
+
+// Overloaded ctor for C-string filename.
+inline BitmapReader::BitmapReader(const char* filename, RowOrder order)
+    : _fileptr(nullptr), _header(Header()), _infoheader(InfoHeader()),
+    _order(order), _stride(0), _rows_read(0) {
+    open_file(filename);
+}
+
+// Overloaded ctor for C++ string filename.
+inline BitmapReader::BitmapReader(const std::string& filename, RowOrder order)
+    : _fileptr(nullptr), _header(Header()), _infoheader(InfoHeader()),
+    _order(order), _stride(0), _rows_read(0) {
+    open_file(filename.c_str());
+}
+
+// Closes the file.
+inline BitmapReader::~BitmapReader() {
+    if (_fileptr != nullptr) fclose(_fileptr);
+}
+
+// Helper method for opening the file and parsing its headers.
+inline void BitmapReader::open_file(const char* filename) {
+    _fileptr = fopen(filename, "rb");
+    if (_fileptr == nullptr) throw FileOpenException();
+    // Read both headers in one go and decode them.
+    uint8_t headers[BitmapParser::CORRECT_TOTAL_HEADER_SIZE];
+    const size_t count = fread(headers, sizeof(char),
+        sizeof(headers), _fileptr);
+    if (count != sizeof(headers)) {
+        const bool eof = feof(_fileptr);
+        fclose(_fileptr);
+        _fileptr = nullptr;
+        if (eof) throw EOFException();
+        throw IOException();
+    }
+    BitmapParser::decode_header(headers, &_header);
+    BitmapParser::decode_infoheader(
+        headers + BitmapParser::CORRECT_HEADER_SIZE, &_infoheader);
+    if (!BitmapParser::compatible(_header, _infoheader)) {
+        fclose(_fileptr);
+        _fileptr = nullptr;
+        throw InvalidFormatException();
+    }
+    _stride = width() * BitmapParser::CORRECT_BYTES_PER_PIXEL +
+        BitmapParser::row_padding(width());
+}
+
+// Index of the next row to be read, with row 0 at the top.
+inline size_t BitmapReader::next_row() const {
+    if (_order == TOP_DOWN) return _rows_read;
+    return height() - 1 - _rows_read;
+}
+
+// Reads the next row into a vector.
+inline bool BitmapReader::read_row(std::vector<Pixel>* row) {
+    if (rows_remaining() == 0) return false;
+    row->resize(width());
+    read_rows(1, row->data(), width());
+    return true;
+}
+
+// Reads a band of rows into a pixel buffer.
+inline size_t BitmapReader::read_band(size_t max_rows, PixelBuffer* band) {
+    const size_t count = std::min(max_rows, rows_remaining());
+    band->resize(width(), count);
+    if (count > 0) read_rows(count, band->data(), width());
+    return count;
+}
+
+/*
+Helper method for decoding rows. The rows to read are always
+one contiguous block of the file, which is read with a single fread.
+For top-down order the block is decoded from its end.
+*/
+inline void BitmapReader::read_rows(size_t count, Pixel* dst,
+    size_t dst_stride) {
+    // Position in the file of the first row of the block.
+    const size_t first_file_row = (_order == BOTTOM_UP) ?
+        _rows_read : height() - _rows_read - count;
+    if (_order == TOP_DOWN) {
+        fseek(_fileptr, _header.data_offset + first_file_row * _stride,
+            SEEK_SET);
+    }
+    /*
+    Like BitmapParser::import, the padding of the
+    last row in the file is not required.
+    */
+    const size_t row_bytes = width() * BitmapParser::CORRECT_BYTES_PER_PIXEL;
+    size_t bytes = count * _stride;
+    if (first_file_row + count == height()) bytes -= _stride - row_bytes;
+    _buffer.resize(count * _stride);
+    fread(_buffer.data(), sizeof(char), bytes, _fileptr);
+    if (feof(_fileptr)) throw EOFException();
+    else if (ferror(_fileptr)) throw IOException();
+    for (size_t i = 0; i < count; ++i) {
+        const size_t block_row = (_order == BOTTOM_UP) ? i : count - 1 - i;
+        bgr_to_pixels(_buffer.data() + block_row * _stride,
+            dst + i * dst_stride, width());
+    }
+    _rows_read += count;
+}
+
+/*
+Streaming writer for bitmap files.
+The width and height are given up front, so the header and info
+header are written straight away, and rows are then written to disk
+as they arrive, without holding the image in memory.
+Rows can be given bottom-up as stored in the file, or top-down.
+*/
+class BitmapWriter {
+ public:
+    // Order in which rows are given.
+    enum RowOrder { BOTTOM_UP, TOP_DOWN };
+
+    BitmapWriter(const char* filename, size_t width, size_t height,
+        RowOrder order = BOTTOM_UP);
+    BitmapWriter(const std::string& filename, size_t width, size_t height,
+        RowOrder order = BOTTOM_UP);
+    ~BitmapWriter();
+    // The file is owned, so copying is not allowed.
+    BitmapWriter(const BitmapWriter&) = delete;
+    BitmapWriter& operator=(const BitmapWriter&) = delete;
+
+    // Header and info header accessors.
+    const Header& read_header() const { return _header; }
+    const InfoHeader& read_infoheader() const { return _infoheader; }
+    size_t width() const { return _infoheader.width; }
+    size_t height() const { return _infoheader.height; }
+    RowOrder order() const { return _order; }
+    // Number of rows not written yet.
+    size_t rows_remaining() const { return height() - _rows_written; }
+    // Index of the next row to be written, with row 0 at the top.
+    size_t next_row() const;
+    // Writes the next row.
+    void write_row(ConstPixelRow row);
+    // Writes the rows of band as the next rows, in writing order.
+    void write_band(ConstPixelView band);
+    // Closes the file, checking that every row was written.
+    void close();
+
+ private:
+    // Opens the file and writes its headers.
+    void open_file(const char* filename, size_t width, size_t height);
+    // Encodes and writes the next count rows from src.
+    void write_rows(size_t count, const Pixel* src, size_t src_stride);
+
+    FILE* _fileptr;
+    Header _header;
+    InfoHeader _infoheader;
+    RowOrder _order;
+    // Bytes from one row to the next in the file, including padding.
+    size_t _stride;
+    size_t _rows_written;
+    // Staging buffer for raw file rows.
+    std::vector<uint8_t> _buffer;
+};
+
+// Overloaded ctor for C-string filename.
+inline BitmapWriter::BitmapWriter(const char* filename, size_t width,
+    size_t height, RowOrder order)
+    : _fileptr(nullptr), _header(Header()), _infoheader(InfoHeader()),
+    _order(order), _stride(0), _rows_written(0) {
+    open_file(filename, width, height);
+}
+
+// Overloaded ctor for C++ string filename.
+inline BitmapWriter::BitmapWriter(const std::string& filename, size_t width,
+    size_t height, RowOrder order)
+    : _fileptr(nullptr), _header(Header()), _infoheader(InfoHeader()),
+    _order(order), _stride(0), _rows_written(0) {
+    open_file(filename.c_str(), width, height);
+}
+
+// Closes the file if close() was not called.
+inline BitmapWriter::~BitmapWriter() {
+    if (_fileptr != nullptr) fclose(_fileptr);
+}
+
+/*
+Helper method for opening the file and writing the headers.
+The headers describe an uncompressed 24-bit image with no palette,
+and the file size is precomputed from the dimensions.
+*/
+inline void BitmapWriter::open_file(const char* filename, size_t width,
+    size_t height) {
+    _header.signature = BitmapParser::CORRECT_SIG;
+    _header.file_size = BitmapParser::calculate_size(width, height);
+    _header.data_offset = BitmapParser::CORRECT_TOTAL_HEADER_SIZE;
+    _infoheader.size = BitmapParser::CORRECT_INFOHEADER_SIZE;
+    _infoheader.width = width;
+    _infoheader.height = height;
+    _infoheader.planes = BitmapParser::CORRECT_PLANES;
+    _infoheader.bits_per_pixel = BitmapParser::CORRECT_BITS_PER_PIXEL;
+    _stride = width * BitmapParser::CORRECT_BYTES_PER_PIXEL +
+        BitmapParser::row_padding(width);
+    _fileptr = fopen(filename, "wb");
+    if (_fileptr == nullptr) throw FileOpenException();
+    // Write both headers in one go.
+    uint8_t headers[BitmapParser::CORRECT_TOTAL_HEADER_SIZE];
+    BitmapParser::encode_header(_header, headers);
+    BitmapParser::encode_infoheader(_infoheader,
+        headers + BitmapParser::CORRECT_HEADER_SIZE);
+    const size_t count = fwrite(headers, sizeof(char),
+        sizeof(headers), _fileptr);
+    if (count != sizeof(headers) || ferror(_fileptr)) {
+        // The destructor does not run if the ctor throws.
+        fclose(_fileptr);
+        _fileptr = nullptr;
+        throw IOException();
+    }
+}
+
+// Index of the next row to be written, with row 0 at the top.
+inline size_t BitmapWriter::next_row() const {
+    if (_order == TOP_DOWN) return _rows_written;
+    return height() - 1 - _rows_written;
+}
+
+// Writes the next row.
+inline void BitmapWriter::write_row(ConstPixelRow row) {
+    if (row.size() != width())
+        throw std::invalid_argument("Row width does not match image!\n");
+    if (rows_remaining() == 0)
+        throw std::out_of_range("All rows have been written!\n");
+    write_rows(1, row.data(), width());
+}
+
+// Writes a band of rows.
+inline void BitmapWriter::write_band(ConstPixelView band) {
+    if (band.width() != width())
+        throw std::invalid_argument("Band width does not match image!\n");
+    if (band.height() > rows_remaining())
+        throw std::out_of_range("Band has more rows than remaining!\n");
+    if (band.height() > 0) write_rows(band.height(), band.data(),
+        band.stride());
+}
+
+// Closes the file.
+inline void BitmapWriter::close() {
+    if (_fileptr == nullptr) return;
+    const int result = fclose(_fileptr);
+    _fileptr = nullptr;
+    if (result != 0) throw IOException();
+    if (rows_remaining() != 0)
+        throw std::logic_error("Not all rows have been written!\n");
+}
+
+/*
+Helper method for encoding rows. The rows to write are always
+one contiguous block of the file, which is written with a single
+fwrite. For top-down order the block is filled from its end, and
+placed by seeking, since the file is written back to front.
+*/
+inline void BitmapWriter::write_rows(size_t count, const Pixel* src,
+    size_t src_stride) {
+    const size_t first_file_row = (_order == BOTTOM_UP) ?
+        _rows_written : height() - _rows_written - count;
+    if (_order == TOP_DOWN) {
+        fseek(_fileptr, _header.data_offset + first_file_row * _stride,
+            SEEK_SET);
+    }
+    const size_t row_bytes = width() * BitmapParser::CORRECT_BYTES_PER_PIXEL;
+    _buffer.resize(count * _stride);
+    for (size_t i = 0; i < count; ++i) {
+        const size_t block_row = (_order == BOTTOM_UP) ? i : count - 1 - i;
+        uint8_t* dst = _buffer.data() + block_row * _stride;
+        pixels_to_bgr(src + i * src_stride, dst, width());
+        // Zero the row padding.
+        std::fill(dst + row_bytes, dst + _stride, 0x0);
+    }
+    fwrite(_buffer.data(), sizeof(char), _buffer.size(), _fileptr);
+    if (ferror(_fileptr)) throw IOException();
+    _rows_written += count;
+}
+
+#ifdef BITMAPPARSER_HAS_MMAP
+/*
+Read only view of pixels laid out as in a bitmap file.
+Rows are stride bytes apart, and the stride is negative for
+bottom-up files so that row 0 is still the top row of the image,
+like in BitmapParser.
+*/
+class BgrView {
+ public:
+    BgrView(const uint8_t* top_row, size_t width, size_t height,
+        ptrdiff_t stride)
+        : _top_row(top_row), _width(width), _height(height),
+        _stride(stride) {}
+
+    BasicPixelRow<const BgrPixel> operator[](size_t row) const {
+        return BasicPixelRow<const BgrPixel>(
+            reinterpret_cast<const BgrPixel*>(
+                _top_row + static_cast<ptrdiff_t>(row) * _stride),
+            _width);
+    }
+    // Number of rows.
+    size_t size() const { return _height; }
+    size_t width() const { return _width; }
+    size_t height() const { return _height; }
+    ptrdiff_t stride() const { return _stride; }
+
+ private:
+    const uint8_t* _top_row;
+    size_t _width;
+    size_t _height;
+    ptrdiff_t _stride;
+};
+
+/*
+Read only access to a bitmap file mapped into memory.
+The header and info header are parsed in place, and pixels are
+read straight from the mapping, so nothing is decoded until it is
+looked at. Use materialize() to copy the image into a BitmapParser
+before editing it.
+*/
+class MappedBitmap {
+ public:
+    explicit MappedBitmap(const char* filename);
+    explicit MappedBitmap(const std::string& filename);
+    ~MappedBitmap();
+    // The mapping is owned, so copying is not allowed.
+    MappedBitmap(const MappedBitmap&) = delete;
+    MappedBitmap& operator=(const MappedBitmap&) = delete;
+
+    // Header and info header accessors.
+    const Header& read_header() const { return _header; }
+    const InfoHeader& read_infoheader() const { return _infoheader; }
+    size_t width() const { return _infoheader.width; }
+    size_t height() const { return _infoheader.height; }
+    // Pixels in file order over the mapping, with row 0 at the top.
+    const BgrView& bgr_pixels() const { return _view; }
+    // Reads a single pixel.
+    Pixel pixel(size_t row, size_t col) const;
+    // Copies the image into a BitmapParser for editing.
+    void materialize(BitmapParser* parser) const;
+
+ private:
+    // Maps the file and parses its headers.
+    void map(const char* filename);
+
+    void* _mapping;
+    size_t _length;
+    Header _header;
+    InfoHeader _infoheader;
+    BgrView _view;
+};
+
+// Overloaded ctor for C-string filename.
+inline MappedBitmap::MappedBitmap(const char* filename)
+    : _mapping(nullptr), _length(0), _header(Header()),
+    _infoheader(InfoHeader()), _view(nullptr, 0, 0, 0) {
+    map(filename);
+}
+
+// Overloaded ctor for C++ string filename.
+inline MappedBitmap::MappedBitmap(const std::string& filename)
+    : _mapping(nullptr), _length(0), _header(Header()),
+    _infoheader(InfoHeader()), _view(nullptr, 0, 0, 0) {
+    map(filename.c_str());
+}
+
+// Unmaps the file.
+inline MappedBitmap::~MappedBitmap() {
+    if (_mapping != nullptr) munmap(_mapping, _length);
+}
+
+// Helper method for mapping the file and parsing its headers.
+inline void MappedBitmap::map(const char* filename) {
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) throw FileOpenException();
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw IOException();
+    }
+    _length = static_cast<size_t>(info.st_size);
+    if (_length < BitmapParser::CORRECT_TOTAL_HEADER_SIZE) {
+        close(fd);
+        throw EOFException();
+    }
+    _mapping = mmap(nullptr, _length, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+    if (_mapping == MAP_FAILED) {
+        _mapping = nullptr;
+        throw IOException();
+    }
+    // Parse the headers in place.
+    const uint8_t* bytes = static_cast<const uint8_t*>(_mapping);
+    BitmapParser::decode_header(bytes, &_header);
+    BitmapParser::decode_infoheader(
+        bytes + BitmapParser::CORRECT_HEADER_SIZE, &_infoheader);
+    if (!BitmapParser::compatible(_header, _infoheader)) {
+        munmap(_mapping, _length);
+        _mapping = nullptr;
+        throw InvalidFormatException();
+    }
+    /*
+    Make sure every row lies inside the mapping.
+    Like import, the last row may be missing its padding.
+    The sizes come from the file, so nothing is multiplied
+    before it is known not to overflow.
+    */
+    const size_t width = _infoheader.width;
+    const size_t height = _infoheader.height;
+    const size_t row_bytes = width * BitmapParser::CORRECT_BYTES_PER_PIXEL;
+    const size_t stride = row_bytes + BitmapParser::row_padding(width);
+    const size_t offset = _header.data_offset;
+    if (height > 0 && (offset > _length ||
+        row_bytes > _length - offset || (stride > 0 &&
+        height - 1 > (_length - offset - row_bytes) / stride))) {
+        munmap(_mapping, _length);
+        _mapping = nullptr;
+        throw EOFException();
+    }
+    // Rows are stored bottom-up, so the top row is the last one.
+    const uint8_t* pixel_data = bytes + _header.data_offset;
+    const uint8_t* top_row = (height > 0) ?
+        pixel_data + stride * (height - 1) : pixel_data;
+    _view = BgrView(top_row, width, height,
+        -static_cast<ptrdiff_t>(stride));
+}
+
+// Reads a single pixel, with row 0 at the top.
+inline Pixel MappedBitmap::pixel(size_t row, size_t col) const {
+    const BgrPixel& bgr = _view[row][col];
+    Pixel pix = {bgr.red, bgr.green, bgr.blue};
+    return pix;
+}
+
+/*
+Copies the headers and pixels into a BitmapParser,
+replacing anything it held before.
+*/
+inline void MappedBitmap::materialize(BitmapParser* parser) const {
+    // Every field is replaced, and the pixels reuse their memory.
+    parser->_fileptr = nullptr;
+    parser->_header = _header;
+    parser->_infoheader = _infoheader;
+    parser->_padding = parser->row_padding();
+    parser->_pixels.resize(width(), height());
+    for (size_t row = 0; row < height(); ++row) {
+        bgr_to_pixels(reinterpret_cast<const uint8_t*>(_view[row].data()),
+            parser->_pixels[row].data(), width());
     }
 }
+#endif  // BITMAPPARSER_HAS_MMAP
 
 #endif  // BITMAPPARSER_H_
@@ -0,0 +1,218 @@
+// Copyright 2019 Jason Kim. All rights reserved.
+/*
+color_kernels_test.cpp
+
+Checks that every invert, grayscale and isolate kernel matches the
+original per-pixel formulas for all 2^24 pixels. Exits with 1 and
+prints the first few mismatches if any kernel differs.
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bitmapparser.h"
+
+namespace {
+
+const size_t ALL_PIXELS = size_t(1) << 24;
+
+enum Filter { INVERT, GRAYSCALE, ISOLATE_RED, ISOLATE_GREEN, ISOLATE_BLUE,
+    FILTER_COUNT };
+
+const char* const FILTER_NAMES[FILTER_COUNT] = {"invert", "grayscale",
+    "isolate_red", "isolate_green", "isolate_blue"};
+
+// The masks isolate_red, isolate_green and isolate_blue use.
+const Pixel MASKS[FILTER_COUNT] = {{0x0, 0x0, 0x0}, {0x0, 0x0, 0x0},
+    {0xff, 0x0, 0x0}, {0x0, 0xff, 0x0}, {0x0, 0x0, 0xff}};
+
+// The filters as they were written before the kernels, one pixel at a time.
+void original(Filter filter, Pixel* pix) {
+    const uint8_t color_max = 0xff;
+    switch (filter) {
+        case INVERT:
+            pix->red = color_max - pix->red;
+            pix->green = color_max - pix->green;
+            pix->blue = color_max - pix->blue;
+            break;
+        case GRAYSCALE: {
+            const uint8_t avg = (pix->red / 3) + (pix->green / 3) +
+                (pix->blue / 3) + (((pix->red % 3) + (pix->green % 3) +
+                (pix->blue % 3)) / 3);
+            pix->red = avg;
+            pix->green = avg;
+            pix->blue = avg;
+            break;
+        }
+        case ISOLATE_RED:
+            pix->green = 0;
+            pix->blue = 0;
+            break;
+        case ISOLATE_GREEN:
+            pix->red = 0;
+            pix->blue = 0;
+            break;
+        case ISOLATE_BLUE:
+            pix->red = 0;
+            pix->green = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+// Every 24-bit color once, and what each original filter makes of it.
+struct Inputs {
+    std::vector<Pixel> pixels;
+    std::vector<Pixel> expected[FILTER_COUNT];
+    Inputs() : pixels(ALL_PIXELS) {
+        for (size_t i = 0; i < ALL_PIXELS; ++i) {
+            pixels[i].red = static_cast<uint8_t>(i >> 16);
+            pixels[i].green = static_cast<uint8_t>(i >> 8);
+            pixels[i].blue = static_cast<uint8_t>(i);
+        }
+        for (int f = 0; f < FILTER_COUNT; ++f) {
+            expected[f] = pixels;
+            for (Pixel& pix : expected[f]) {
+                original(static_cast<Filter>(f), &pix);
+            }
+        }
+    }
+};
+
+// Runs the kernel in a table that implements filter.
+void apply(const ColorKernels& kernels, Filter filter, Pixel* pixels,
+    size_t count) {
+    if (filter == INVERT) {
+        kernels.invert(pixels, count);
+    } else if (filter == GRAYSCALE) {
+        kernels.grayscale(pixels, count);
+    } else {
+        kernels.mask(pixels, count, MASKS[filter]);
+    }
+}
+
+// Compares a kernel's output to the original filter, reporting mismatches.
+bool check(const std::string& name, Filter filter, const Inputs& inputs,
+    const std::vector<Pixel>& actual) {
+    size_t mismatches = 0;
+    for (size_t i = 0; i < ALL_PIXELS; ++i) {
+        const Pixel& want = inputs.expected[filter][i];
+        const Pixel& got = actual[i];
+        if (want.red == got.red && want.green == got.green &&
+            want.blue == got.blue) continue;
+        if (mismatches++ < 5) {
+            const Pixel& in = inputs.pixels[i];
+            std::cout << name << ": (" << +in.red << ", " << +in.green
+                << ", " << +in.blue << ") gave (" << +got.red << ", "
+                << +got.green << ", " << +got.blue << "), expected ("
+                << +want.red << ", " << +want.green << ", "
+                << +want.blue << ")\n";
+        }
+    }
+    std::cout << name << ": " << mismatches << " mismatches\n";
+    return mismatches == 0;
+}
+
+/*
+Runs every filter of a kernel table over every input at once, then in
+short runs of every length up to 64, so the vector kernels also go
+through their tails for every input.
+*/
+bool check_table(const std::string& name, const Inputs& inputs,
+    const ColorKernels& kernels) {
+    bool passed = true;
+    for (int f = 0; f < FILTER_COUNT; ++f) {
+        const Filter filter = static_cast<Filter>(f);
+        const std::string label = name + " " + FILTER_NAMES[f];
+        std::vector<Pixel> actual = inputs.pixels;
+        apply(kernels, filter, actual.data(), actual.size());
+        passed &= check(label, filter, inputs, actual);
+        actual = inputs.pixels;
+        size_t length = 1;
+        for (size_t i = 0; i < ALL_PIXELS; i += length) {
+            length = std::min(length % 64 + 1, ALL_PIXELS - i);
+            apply(kernels, filter, actual.data() + i, length);
+        }
+        passed &= check(label + " in short runs", filter, inputs, actual);
+    }
+    return passed;
+}
+
+// Runs the filters for a pixel format other than Pixel.
+template <typename Format>
+bool check_format(const char* name, const Inputs& inputs) {
+    typedef typename Format::PixelType PixelType;
+    bool passed = true;
+    for (int f = 0; f < FILTER_COUNT; ++f) {
+        const Filter filter = static_cast<Filter>(f);
+        std::vector<PixelType> converted(ALL_PIXELS);
+        for (size_t i = 0; i < ALL_PIXELS; ++i) {
+            uint8_t* bytes = reinterpret_cast<uint8_t*>(&converted[i]);
+            bytes[Format::red] = inputs.pixels[i].red;
+            bytes[Format::green] = inputs.pixels[i].green;
+            bytes[Format::blue] = inputs.pixels[i].blue;
+        }
+        if (filter == INVERT) {
+            FormatKernels<Format>::invert(converted.data(), ALL_PIXELS);
+        } else if (filter == GRAYSCALE) {
+            FormatKernels<Format>::grayscale(converted.data(), ALL_PIXELS);
+        } else {
+            FormatKernels<Format>::mask(converted.data(), ALL_PIXELS,
+                MASKS[filter]);
+        }
+        std::vector<Pixel> actual(ALL_PIXELS);
+        for (size_t i = 0; i < ALL_PIXELS; ++i) {
+            const uint8_t* bytes =
+                reinterpret_cast<uint8_t*>(&converted[i]);
+            actual[i].red = bytes[Format::red];
+            actual[i].green = bytes[Format::green];
+            actual[i].blue = bytes[Format::blue];
+        }
+        passed &= check(std::string(name) + " " + FILTER_NAMES[f], filter,
+            inputs, actual);
+    }
+    return passed;
+}
+
+}  // namespace
+
+int main() {
+    const Inputs inputs;
+    bool passed = true;
+    passed &= check_table("scalar", inputs, ColorKernels::scalar());
+    passed &= check_table("best", inputs, ColorKernels::best());
+#ifdef BITMAPPARSER_HAS_X86_SIMD
+    // One table per instruction set, so each is tested even when a wider
+    // one would win in best().
+    if (cpu_supports_sse2()) {
+        ColorKernels sse2 = ColorKernels::scalar();
+        sse2.invert = invert_pixels_sse2;
+        sse2.mask = mask_pixels_sse2;
+        passed &= check_table("sse2", inputs, sse2);
+    } else {
+        std::cout << "sse2: not supported by this CPU, skipped\n";
+    }
+    if (cpu_supports_ssse3()) {
+        ColorKernels ssse3 = ColorKernels::scalar();
+        ssse3.grayscale = grayscale_pixels_ssse3;
+        passed &= check_table("ssse3", inputs, ssse3);
+    } else {
+        std::cout << "ssse3: not supported by this CPU, skipped\n";
+    }
+    if (cpu_supports_avx2()) {
+        ColorKernels avx2 = ColorKernels::scalar();
+        avx2.invert = invert_pixels_avx2;
+        avx2.grayscale = grayscale_pixels_avx2;
+        avx2.mask = mask_pixels_avx2;
+        passed &= check_table("avx2", inputs, avx2);
+    } else {
+        std::cout << "avx2: not supported by this CPU, skipped\n";
+    }
+#endif
+    passed &= check_format<Bgr24Format>("Bgr24Format", inputs);
+    passed &= check_format<Bgra32Format>("Bgra32Format", inputs);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,16 @@
+// Copyright 2019 Jason Kim. All rights reserved.
+/*
+multiple_units_other.cpp
+
+Second translation unit for multiple_units_test.cpp.
+*/
+
+#include "bitmapparser.h"
+
+BufferPool* other_buffer_pool() {
+    return &BufferPool::shared();
+}
+
+RowBandScheduler* other_scheduler() {
+    return &RowBandScheduler::shared();
+}
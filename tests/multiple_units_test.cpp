@@ -0,0 +1,25 @@
+// Copyright 2019 Jason Kim. All rights reserved.
+/*
+multiple_units_test.cpp
+
+The header is included here and in multiple_units_other.cpp. Linking
+the two checks that nothing in it is defined more than once, and the
+shared pools must be the same object in both translation units.
+*/
+
+#include <iostream>
+
+#include "bitmapparser.h"
+
+// Defined in multiple_units_other.cpp.
+BufferPool* other_buffer_pool();
+RowBandScheduler* other_scheduler();
+
+int main() {
+    if (other_buffer_pool() != &BufferPool::shared() ||
+        other_scheduler() != &RowBandScheduler::shared()) {
+        std::cout << "shared pools differ between translation units\n";
+        return 1;
+    }
+    return 0;
+}
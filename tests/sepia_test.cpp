@@ -0,0 +1,123 @@
+// Copyright 2019 Jason Kim. All rights reserved.
+/*
+sepia_test.cpp
+
+Checks that every sepia kernel matches the original double precision
+formula, sepia_pixel_double, for all 2^24 pixels. Exits with 1 and
+prints the first few mismatches if any kernel differs.
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "bitmapparser.h"
+
+namespace {
+
+const size_t ALL_PIXELS = size_t(1) << 24;
+
+// Every 24-bit color once, and what the double formula makes of it.
+struct Inputs {
+    std::vector<Pixel> pixels;
+    std::vector<Pixel> expected;
+    Inputs() : pixels(ALL_PIXELS) {
+        for (size_t i = 0; i < ALL_PIXELS; ++i) {
+            pixels[i].red = static_cast<uint8_t>(i >> 16);
+            pixels[i].green = static_cast<uint8_t>(i >> 8);
+            pixels[i].blue = static_cast<uint8_t>(i);
+        }
+        expected = pixels;
+        for (Pixel& pix : expected) sepia_pixel_double(&pix);
+    }
+};
+
+// Compares a kernel's output to the double formula, reporting mismatches.
+bool check(const char* name, const Inputs& inputs,
+    const std::vector<Pixel>& actual) {
+    size_t mismatches = 0;
+    for (size_t i = 0; i < ALL_PIXELS; ++i) {
+        const Pixel& want = inputs.expected[i];
+        const Pixel& got = actual[i];
+        if (want.red == got.red && want.green == got.green &&
+            want.blue == got.blue) continue;
+        if (mismatches++ < 5) {
+            const Pixel& in = inputs.pixels[i];
+            std::cout << name << ": (" << +in.red << ", " << +in.green
+                << ", " << +in.blue << ") gave (" << +got.red << ", "
+                << +got.green << ", " << +got.blue << "), expected ("
+                << +want.red << ", " << +want.green << ", "
+                << +want.blue << ")\n";
+        }
+    }
+    std::cout << name << ": " << mismatches << " mismatches\n";
+    return mismatches == 0;
+}
+
+// Runs a Pixel kernel over every input at once.
+bool check_kernel(const char* name, const Inputs& inputs,
+    void (*kernel)(Pixel* pixels, size_t count)) {
+    std::vector<Pixel> actual = inputs.pixels;
+    kernel(actual.data(), actual.size());
+    return check(name, inputs, actual);
+}
+
+/*
+Runs a kernel in short runs of every length up to 64, so the vector
+kernels also go through their tails for every input.
+*/
+bool check_runs(const char* name, const Inputs& inputs,
+    void (*kernel)(Pixel* pixels, size_t count)) {
+    std::vector<Pixel> actual = inputs.pixels;
+    size_t length = 1;
+    for (size_t i = 0; i < ALL_PIXELS; i += length) {
+        length = std::min(length % 64 + 1, ALL_PIXELS - i);
+        kernel(actual.data() + i, length);
+    }
+    return check(name, inputs, actual);
+}
+
+// Runs the kernel for a pixel format other than Pixel.
+template <typename Format>
+bool check_format(const char* name, const Inputs& inputs) {
+    typedef typename Format::PixelType PixelType;
+    std::vector<PixelType> converted(ALL_PIXELS);
+    for (size_t i = 0; i < ALL_PIXELS; ++i) {
+        uint8_t* bytes = reinterpret_cast<uint8_t*>(&converted[i]);
+        bytes[Format::red] = inputs.pixels[i].red;
+        bytes[Format::green] = inputs.pixels[i].green;
+        bytes[Format::blue] = inputs.pixels[i].blue;
+    }
+    FormatKernels<Format>::sepia(converted.data(), converted.size());
+    std::vector<Pixel> actual(ALL_PIXELS);
+    for (size_t i = 0; i < ALL_PIXELS; ++i) {
+        const uint8_t* bytes = reinterpret_cast<uint8_t*>(&converted[i]);
+        actual[i].red = bytes[Format::red];
+        actual[i].green = bytes[Format::green];
+        actual[i].blue = bytes[Format::blue];
+    }
+    return check(name, inputs, actual);
+}
+
+}  // namespace
+
+int main() {
+    const Inputs inputs;
+    bool passed = true;
+    passed &= check_kernel("scalar", inputs, sepia_pixels_scalar);
+    passed &= check_kernel("best", inputs, ColorKernels::best().sepia);
+    passed &= check_runs("best in short runs", inputs,
+        ColorKernels::best().sepia);
+#ifdef BITMAPPARSER_HAS_X86_SIMD
+    if (cpu_supports_avx2()) {
+        passed &= check_kernel("avx2", inputs, sepia_pixels_avx2);
+        passed &= check_runs("avx2 in short runs", inputs,
+            sepia_pixels_avx2);
+    } else {
+        std::cout << "avx2: not supported by this CPU, skipped\n";
+    }
+#endif
+    passed &= check_format<Bgr24Format>("Bgr24Format", inputs);
+    passed &= check_format<Bgra32Format>("Bgra32Format", inputs);
+    return passed ? 0 : 1;
+}